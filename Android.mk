@@ -16,7 +16,20 @@ common_src_files := \
 	VolumeBase.cpp \
 	PublicVolume.cpp \
 	ResponseCode.cpp \
-	Utils.cpp
+	Utils.cpp \
+	UeventRecorder.cpp \
+	UeventCoalescer.cpp \
+	GlobMatcher.cpp \
+	BlockEvent.cpp \
+	JobExecutor.cpp \
+	EventDispatcher.cpp \
+	StorageEvent.cpp \
+	EventChannel.cpp \
+	StorageState.cpp \
+	FsProbe.cpp \
+	BlockTopology.cpp \
+	PartitionTable.cpp \
+	Checksum.cpp
 
 common_c_includes := \
 	system/libhidl/transport/include/hidl \
@@ -24,8 +37,10 @@ common_c_includes := \
 
 common_shared_libraries := \
 	vendor.amlogic.hardware.droidvold@1.0_vendor \
+	vendor.amlogic.droidvold@1.0_vendor \
 	libhidlbase \
 	libhidltransport \
+	libfmq \
 	libsysutils \
 	libcutils \
 	liblog \
@@ -70,3 +85,29 @@ LOCAL_STATIC_LIBRARIES := $(common_static_libraries)
 LOCAL_PROPRIETARY_MODULE := true
 
 include $(BUILD_EXECUTABLE)
+
+# The same daemon with heap allocations counted for --replay. Never
+# started by init; build it by name when profiling the uevent path.
+include $(CLEAR_VARS)
+
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_MODULE := droidvold_replay
+LOCAL_MODULE_TAGS := optional
+LOCAL_CLANG := true
+LOCAL_SRC_FILES := \
+	main.cpp \
+	$(common_src_files)
+
+LOCAL_C_INCLUDES := $(common_c_includes)
+LOCAL_CFLAGS := $(vold_cflags)
+LOCAL_CFLAGS += -DHAS_NTFS_3G
+LOCAL_CFLAGS += -DHAS_VIRTUAL_CDROM
+LOCAL_CFLAGS += -DREPLAY_COUNT_ALLOCATIONS
+LOCAL_CONLYFLAGS := $(vold_conlyflags)
+
+LOCAL_SHARED_LIBRARIES := $(common_shared_libraries)
+LOCAL_STATIC_LIBRARIES := $(common_static_libraries)
+
+LOCAL_PROPRIETARY_MODULE := true
+
+include $(BUILD_EXECUTABLE)
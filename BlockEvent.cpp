@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BlockEvent.h"
+
+#include <stdlib.h>
+
+namespace android {
+namespace droidvold {
+
+static int findIntParam(NetlinkEvent* evt, const char* name) {
+    const char* value = evt->findParam(name);
+    return value ? atoi(value) : -1;
+}
+
+BlockEvent::BlockEvent(const std::shared_ptr<NetlinkEvent>& evt) :
+        event(evt), action(evt->getAction()), type(Type::kOther),
+        devPath(evt->findParam("DEVPATH")), devName(evt->findParam("DEVNAME")),
+        devType(evt->findParam("DEVTYPE")), devMajor(findIntParam(evt.get(), "MAJOR")),
+        devMinor(findIntParam(evt.get(), "MINOR")), partN(findIntParam(evt.get(), "PARTN")) {
+    if (devType == "disk") {
+        type = Type::kDisk;
+    } else if (devType == "partition") {
+        type = Type::kPartition;
+    }
+}
+
+}  // namespace droidvold
+}  // namespace android
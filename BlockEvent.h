@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_BLOCK_EVENT_H
+#define ANDROID_VOLD_BLOCK_EVENT_H
+
+#include <sysutils/NetlinkEvent.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * A block uevent parsed once into the fields droidvold routes on. The
+ * strings point into the parameters of the NetlinkEvent, which the record
+ * keeps alive, so passing it around never copies them.
+ */
+struct BlockEvent {
+    /* Non-owning view of a NUL terminated parameter, empty if missing */
+    struct Field {
+        const char* data;
+        size_t size;
+
+        Field() : data(""), size(0) {}
+        explicit Field(const char* str) : data(str ? str : ""), size(str ? strlen(str) : 0) {}
+
+        bool empty() const { return size == 0; }
+        bool operator==(const char* str) const { return !strcmp(data, str); }
+        bool operator!=(const char* str) const { return strcmp(data, str); }
+        std::string str() const { return std::string(data, size); }
+
+        /* True if this is path strictly below dir, e.g. .../sda/sda1 */
+        bool isBelow(const std::string& dir) const {
+            return size > dir.size() && data[dir.size()] == '/'
+                    && !memcmp(data, dir.data(), dir.size());
+        }
+    };
+
+    enum class Type {
+        kOther,
+        kDisk,
+        kPartition,
+    };
+
+    explicit BlockEvent(const std::shared_ptr<NetlinkEvent>& evt);
+
+    std::shared_ptr<NetlinkEvent> event;
+    NetlinkEvent::Action action;
+    Type type;
+    Field devPath;
+    Field devName;
+    Field devType;
+    int devMajor;
+    int devMinor;
+    int partN;
+
+    dev_t getDevice() const { return makedev(devMajor, devMinor); }
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BlockTopology.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <memory>
+
+using android::base::ReadFileToString;
+using android::base::StringPrintf;
+
+namespace android {
+namespace droidvold {
+
+static const char* kSysDevBlockPath = "/sys/dev/block";
+
+static std::string baseName(const std::string& path) {
+    size_t pos = path.rfind('/');
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+static std::string dirName(const std::string& path) {
+    size_t pos = path.rfind('/');
+    return pos == std::string::npos ? std::string() : path.substr(0, pos);
+}
+
+/* Names of the entries in a holders or slaves directory */
+static void readLinks(const std::string& path, std::vector<std::string>& names) {
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(path.c_str()), closedir);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent* de;
+    while ((de = readdir(dir.get())) != nullptr) {
+        if (de->d_name[0] != '.') {
+            names.push_back(de->d_name);
+        }
+    }
+}
+
+static void addLink(std::vector<dev_t>& links, dev_t device) {
+    if (std::find(links.begin(), links.end(), device) == links.end()) {
+        links.push_back(device);
+    }
+}
+
+static void eraseLink(std::vector<dev_t>& links, dev_t device) {
+    links.erase(std::remove(links.begin(), links.end(), device), links.end());
+}
+
+static void readNode(dev_t device, const std::string& sysPath, BlockTopology::Node& node) {
+    node.device = device;
+    node.sysPath = sysPath;
+    node.name = baseName(sysPath);
+    node.parent = 0;
+
+    std::string partition;
+    node.partN = ReadFileToString(sysPath + "/partition", &partition)
+            ? atoi(partition.c_str()) : 0;
+}
+
+BlockTopology* BlockTopology::Instance() {
+    static BlockTopology* sInstance = new BlockTopology();
+    return sInstance;
+}
+
+status_t BlockTopology::scan() {
+    std::lock_guard<std::mutex> lock(mLock);
+    scanLocked();
+    return mNodes.empty() ? -ENOENT : OK;
+}
+
+void BlockTopology::invalidate() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mLoaded = false;
+}
+
+void BlockTopology::ensureLoadedLocked() {
+    if (!mLoaded) {
+        scanLocked();
+    }
+}
+
+void BlockTopology::scanLocked() {
+    mNodes.clear();
+    mByName.clear();
+    // Even if sysfs is unreadable, don't retry on every query
+    mLoaded = true;
+    mScans++;
+
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(kSysDevBlockPath), closedir);
+    if (!dir) {
+        PLOG(ERROR) << "Failed to open " << kSysDevBlockPath;
+        return;
+    }
+
+    // Each entry is a major:minor link to the device under /sys/devices
+    std::vector<Node> nodes;
+    struct dirent* de;
+    while ((de = readdir(dir.get())) != nullptr) {
+        unsigned int devMajor, devMinor;
+        if (sscanf(de->d_name, "%u:%u", &devMajor, &devMinor) != 2) {
+            continue;
+        }
+
+        std::string link = StringPrintf("%s/%s", kSysDevBlockPath, de->d_name);
+        char realPath[PATH_MAX];
+        if (realpath(link.c_str(), realPath) == nullptr) {
+            continue;
+        }
+
+        Node node;
+        readNode(makedev(devMajor, devMinor), realPath, node);
+        nodes.push_back(node);
+    }
+
+    // Whole devices first, so every partition finds its disk
+    std::stable_sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) {
+        return a.partN == 0 && b.partN != 0;
+    });
+    for (auto& node : nodes) {
+        addLocked(node);
+    }
+}
+
+void BlockTopology::addLocked(Node node) {
+    removeLocked(node.device);
+
+    if (node.partN > 0) {
+        auto parent = mByName.find(baseName(dirName(node.sysPath)));
+        if (parent != mByName.end()) {
+            node.parent = parent->second;
+            addLink(mNodes[node.parent].partitions, node.device);
+        }
+    } else {
+        // Re-added disk, e.g. by a resync; adopt the partitions below it
+        for (auto& entry : mNodes) {
+            Node& child = entry.second;
+            if (child.partN > 0 && child.parent == 0 && dirName(child.sysPath) == node.sysPath) {
+                child.parent = node.device;
+                addLink(node.partitions, child.device);
+            }
+        }
+    }
+
+    linkStackLocked(node);
+    mByName[node.name] = node.device;
+    mNodes[node.device] = std::move(node);
+}
+
+void BlockTopology::removeLocked(dev_t device) {
+    auto it = mNodes.find(device);
+    if (it == mNodes.end()) {
+        return;
+    }
+
+    Node& node = it->second;
+    unlinkStackLocked(node);
+    auto parent = mNodes.find(node.parent);
+    if (parent != mNodes.end()) {
+        eraseLink(parent->second.partitions, device);
+    }
+    // The kernel removes partitions before their disk, but don't rely on it
+    for (dev_t part : node.partitions) {
+        auto child = mNodes.find(part);
+        if (child != mNodes.end()) {
+            child->second.parent = 0;
+        }
+    }
+
+    auto name = mByName.find(node.name);
+    if (name != mByName.end() && name->second == device) {
+        mByName.erase(name);
+    }
+    mNodes.erase(it);
+}
+
+void BlockTopology::linkStackLocked(Node& node) {
+    unlinkStackLocked(node);
+
+    // Only devices already known can be linked; whichever side comes
+    // second links both.
+    std::vector<std::string> names;
+    readLinks(node.sysPath + "/holders", names);
+    for (auto& name : names) {
+        auto holder = mByName.find(name);
+        if (holder != mByName.end() && holder->second != node.device) {
+            addLink(node.holders, holder->second);
+            addLink(mNodes[holder->second].slaves, node.device);
+        }
+    }
+
+    names.clear();
+    readLinks(node.sysPath + "/slaves", names);
+    for (auto& name : names) {
+        auto slave = mByName.find(name);
+        if (slave != mByName.end() && slave->second != node.device) {
+            addLink(node.slaves, slave->second);
+            addLink(mNodes[slave->second].holders, node.device);
+        }
+    }
+}
+
+void BlockTopology::unlinkStackLocked(Node& node) {
+    for (dev_t holder : node.holders) {
+        auto it = mNodes.find(holder);
+        if (it != mNodes.end()) {
+            eraseLink(it->second.slaves, node.device);
+        }
+    }
+    for (dev_t slave : node.slaves) {
+        auto it = mNodes.find(slave);
+        if (it != mNodes.end()) {
+            eraseLink(it->second.holders, node.device);
+        }
+    }
+    node.holders.clear();
+    node.slaves.clear();
+}
+
+void BlockTopology::handleBlockEvent(const BlockEvent& evt) {
+    std::lock_guard<std::mutex> lock(mLock);
+    // The first query scans whatever is current by then
+    if (!mLoaded) {
+        return;
+    }
+
+    dev_t device = evt.getDevice();
+    switch (evt.action) {
+    case NetlinkEvent::Action::kAdd: {
+        Node node;
+        readNode(device, "/sys" + evt.devPath.str(), node);
+        addLocked(node);
+        break;
+    }
+    case NetlinkEvent::Action::kChange: {
+        // e.g. a dm table load, which may change what it is stacked on
+        auto it = mNodes.find(device);
+        if (it != mNodes.end()) {
+            linkStackLocked(it->second);
+        }
+        break;
+    }
+    case NetlinkEvent::Action::kRemove: {
+        removeLocked(device);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool BlockTopology::findDevice(dev_t device, Node& node) {
+    std::lock_guard<std::mutex> lock(mLock);
+    ensureLoadedLocked();
+    auto it = mNodes.find(device);
+    if (it == mNodes.end()) {
+        return false;
+    }
+    node = it->second;
+    return true;
+}
+
+bool BlockTopology::findByName(const std::string& name, Node& node) {
+    std::lock_guard<std::mutex> lock(mLock);
+    ensureLoadedLocked();
+    auto it = mByName.find(name);
+    if (it == mByName.end()) {
+        return false;
+    }
+    node = mNodes[it->second];
+    return true;
+}
+
+bool BlockTopology::findPartition(dev_t disk, int partN, dev_t& device) {
+    std::lock_guard<std::mutex> lock(mLock);
+    ensureLoadedLocked();
+    auto it = mNodes.find(disk);
+    if (it == mNodes.end()) {
+        return false;
+    }
+    for (dev_t part : it->second.partitions) {
+        auto child = mNodes.find(part);
+        if (child != mNodes.end() && child->second.partN == partN) {
+            device = part;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t BlockTopology::size() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mNodes.size();
+}
+
+}  // namespace droidvold
+}  // namespace android
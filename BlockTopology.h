@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_BLOCK_TOPOLOGY_H
+#define ANDROID_VOLD_BLOCK_TOPOLOGY_H
+
+#include "BlockEvent.h"
+#include "Utils.h"
+
+#include <utils/Errors.h>
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Every block device the kernel knows about: disks, their partitions,
+ * and the devices stacked on them (holders, e.g. dm). The graph is built
+ * from /sys/dev/block on first use and then kept current from block
+ * uevents, so topology questions never fork ls or blkid.
+ */
+class BlockTopology {
+public:
+    struct Node {
+        dev_t device;
+        /* Kernel name, also the node under /dev/block */
+        std::string name;
+        /* Resolved device path under sysfs */
+        std::string sysPath;
+        /* Disk holding a partition, 0 for whole devices */
+        dev_t parent;
+        /* Partition number, 0 for whole devices */
+        int partN;
+        std::vector<dev_t> partitions;
+        /* Devices stacked on this one, and the ones it is stacked on */
+        std::vector<dev_t> holders;
+        std::vector<dev_t> slaves;
+    };
+
+    static BlockTopology* Instance();
+
+    /* Rebuilds the graph from /sys/dev/block */
+    status_t scan();
+    /* Rescans on next use, e.g. after uevents were lost */
+    void invalidate();
+    /* Applies an add, change or remove uevent to the graph */
+    void handleBlockEvent(const BlockEvent& evt);
+
+    bool findDevice(dev_t device, Node& node);
+    bool findByName(const std::string& name, Node& node);
+    bool findPartition(dev_t disk, int partN, dev_t& device);
+
+    size_t size();
+    uint64_t getScanCount() { return mScans; }
+
+private:
+    BlockTopology() : mLoaded(false), mScans(0) {}
+
+    void scanLocked();
+    void ensureLoadedLocked();
+    void addLocked(Node node);
+    void removeLocked(dev_t device);
+    /* Re-reads the holders and slaves links of a node from sysfs */
+    void linkStackLocked(Node& node);
+    void unlinkStackLocked(Node& node);
+
+    std::mutex mLock;
+    std::unordered_map<dev_t, Node> mNodes;
+    std::unordered_map<std::string, dev_t> mByName;
+    bool mLoaded;
+    std::atomic<uint64_t> mScans;
+
+    DISALLOW_COPY_AND_ASSIGN(BlockTopology);
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
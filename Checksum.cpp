@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Checksum.h"
+
+#include <string.h>
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#if defined(__clang__)
+#define TARGET_ARMV8_CRC __attribute__((target("crc")))
+#else
+#define TARGET_ARMV8_CRC __attribute__((target("+crc")))
+#endif
+#elif defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+
+namespace android {
+namespace droidvold {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "slicing-by-8 loads assume little-endian");
+
+namespace {
+
+typedef uint32_t (*CrcFunction)(uint32_t crc, const uint8_t* p, size_t len);
+
+/* Reflected polynomials */
+const uint32_t kCrc32Poly = 0xedb88320;
+const uint32_t kCrc32cPoly = 0x82f63b78;
+
+/* t[k][b] is the CRC of byte b followed by k zero bytes */
+struct CrcTables {
+    uint32_t t[8][256];
+
+    explicit CrcTables(uint32_t poly) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? poly ^ (c >> 1) : c >> 1;
+            }
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+uint32_t crcSlicing(const CrcTables& tables, uint32_t crc, const uint8_t* p, size_t len) {
+    const uint32_t (*t)[256] = tables.t;
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff]
+                ^ t[4][lo >> 24] ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff]
+                ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+uint32_t crc32Slicing(uint32_t crc, const uint8_t* p, size_t len) {
+    static const CrcTables tables(kCrc32Poly);
+    return crcSlicing(tables, crc, p, len);
+}
+
+uint32_t crc32cSlicing(uint32_t crc, const uint8_t* p, size_t len) {
+    static const CrcTables tables(kCrc32cPoly);
+    return crcSlicing(tables, crc, p, len);
+}
+
+#if defined(__aarch64__)
+TARGET_ARMV8_CRC uint32_t crc32Armv8(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len && ((uintptr_t) p & 7)) {
+        crc = __crc32b(crc, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32d(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+    return crc;
+}
+
+TARGET_ARMV8_CRC uint32_t crc32cArmv8(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len && ((uintptr_t) p & 7)) {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#elif defined(__x86_64__) || defined(__i386__)
+/* SSE4.2 only has the Castagnoli polynomial */
+TARGET_SSE42 uint32_t crc32cSse42(uint32_t crc, const uint8_t* p, size_t len) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+struct CrcImplementation {
+    CrcFunction crc32;
+    CrcFunction crc32c;
+    const char* name;
+};
+
+CrcImplementation pickImplementation() {
+#if defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        return { crc32Armv8, crc32cArmv8, "armv8-crc" };
+    }
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return { crc32Slicing, crc32cSse42, "sse4.2" };
+    }
+#endif
+    return { crc32Slicing, crc32cSlicing, "slicing-by-8" };
+}
+
+const CrcImplementation& getImplementation() {
+    static const CrcImplementation impl = pickImplementation();
+    return impl;
+}
+
+uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+}  // namespace
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t len) {
+    return getImplementation().crc32(crc, static_cast<const uint8_t*>(data), len);
+}
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t len) {
+    return getImplementation().crc32c(crc, static_cast<const uint8_t*>(data), len);
+}
+
+const char* GetCrcImplementation() {
+    return getImplementation().name;
+}
+
+uint32_t ExfatBootChecksum(const uint8_t* region, size_t sectorSize) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < 11 * sectorSize; i++) {
+        // VolumeFlags and PercentInUse
+        if (i == 106 || i == 107 || i == 112) {
+            continue;
+        }
+        sum = ((sum << 31) | (sum >> 1)) + region[i];
+    }
+    return sum;
+}
+
+bool ApplyNtfsFixups(uint8_t* record, size_t len) {
+    static const size_t kBlockSize = 512;
+    if (len < kBlockSize || len % kBlockSize) {
+        return false;
+    }
+
+    // Update sequence array: the USN, then the saved last two bytes of
+    // every block. It must not overlap the bytes it restores.
+    size_t usaOff = le16(record + 4);
+    size_t usaCount = le16(record + 6);
+    if ((usaOff & 1) || usaCount != len / kBlockSize + 1
+            || usaOff + usaCount * 2 > kBlockSize - 2) {
+        return false;
+    }
+
+    const uint8_t* usa = record + usaOff;
+    for (size_t i = 1; i < usaCount; i++) {
+        if (memcmp(record + i * kBlockSize - 2, usa, 2)) {
+            return false;
+        }
+    }
+    for (size_t i = 1; i < usaCount; i++) {
+        memcpy(record + i * kBlockSize - 2, usa + i * 2, 2);
+    }
+    return true;
+}
+
+}  // namespace droidvold
+}  // namespace android
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_CHECKSUM_H
+#define ANDROID_VOLD_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Checksums of on-disk structures. The CRCs use the CPU's CRC
+ * instructions when it has them, picked once at runtime: ARMv8 CRC32 for
+ * both polynomials, SSE4.2 for CRC32C. Otherwise they use slicing-by-8
+ * tables.
+ */
+
+/*
+ * Raw updates without the initial and final inversion, like the kernel's
+ * crc32_le() and crc32c(). The usual CRC-32 of a buffer, e.g. in a GPT
+ * header, is ~Crc32(~0, data, len).
+ */
+uint32_t Crc32(uint32_t crc, const void* data, size_t len);
+/* Castagnoli polynomial, as in ext4 metadata_csum */
+uint32_t Crc32c(uint32_t crc, const void* data, size_t len);
+
+/* Which implementation the CRCs use on this CPU */
+const char* GetCrcImplementation();
+
+/*
+ * exFAT boot region checksum over the first 11 sectors, skipping the
+ * VolumeFlags and PercentInUse fields that change at runtime. Sector 11
+ * repeats the expected value.
+ */
+uint32_t ExfatBootChecksum(const uint8_t* region, size_t sectorSize);
+
+/*
+ * Undoes the NTFS multi-sector protection of an MFT or index record in
+ * place. The last two bytes of every 512-byte block must match the update
+ * sequence number; they are replaced by the saved originals. Returns
+ * false, leaving the record untouched, if it is torn or malformed.
+ */
+bool ApplyNtfsFixups(uint8_t* record, size_t len);
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
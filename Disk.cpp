@@ -15,6 +15,7 @@
  */
 
 #include "Disk.h"
+#include "FsProbe.h"
 #include "PublicVolume.h"
 #include "Utils.h"
 #include "VolumeBase.h"
@@ -25,11 +26,16 @@
 #include <android-base/stringprintf.h>
 #include <android-base/logging.h>
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
 #include <vector>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
@@ -41,8 +47,6 @@ using android::base::StringPrintf;
 namespace android {
 namespace droidvold {
 
-static const char* kSgdiskPath = "/system/bin/sgdisk";
-static const char* kSgdiskToken = " \t\n";
 
 static const char* kSysfsMmcMaxMinors = "/sys/module/mmcblk/parameters/perdev_minors";
 
@@ -67,15 +71,14 @@ static const unsigned int kMajorBlockMmc = 179;
 static const unsigned int kMajorBlockExperimentalMin = 240;
 static const unsigned int kMajorBlockExperimentalMax = 254;
 
-static const char* kGptBasicData = "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7";
 static const char* kGptAndroidMeta = "19A710A2-B3CA-11E4-B026-10604B889DCF";
 static const char* kGptAndroidExpand = "193D1EA4-B3CA-11E4-B075-10604B889DCF";
 
-enum class Table {
-    kUnknown,
-    kMbr,
-    kGpt,
-};
+/* Extended containers and adoptable storage parts never hold a public volume */
+static bool isVolumePartition(const PartitionTable::Partition& part) {
+    return !part.container && strcasecmp(part.typeGuid.c_str(), kGptAndroidMeta)
+            && strcasecmp(part.typeGuid.c_str(), kGptAndroidExpand);
+}
 
 static bool isVirtioBlkDevice(unsigned int major) {
     /*
@@ -106,8 +109,8 @@ static bool isVirtioBlkDevice(unsigned int major) {
 
 Disk::Disk(const std::string& eventPath, dev_t device,
         const std::string& nickname, const std::string& eventName, int flags):
-        mDevice(device), mSize(-1), mNickname(nickname), mFlags(flags), mCreated(
-                false), mJustPartitioned(false) {
+        mDevice(device), mSize(-1), mMediaTime(0), mGeneration(0), mNickname(nickname), mFlags(flags), mCreated(
+                false), mJustPartitioned(false), mWorkerRunning(false) {
     mId = StringPrintf("disk:%u,%u", major(device), minor(device));
     mEventPath = eventPath;
     mDevName = eventName;
@@ -121,7 +124,119 @@ Disk::~Disk() {
     CHECK(!mCreated);
 }
 
+void Disk::post(std::function<void()> work) {
+    std::lock_guard<std::mutex> lock(mQueueLock);
+    mQueue.push_back(std::move(work));
+    if (!mWorkerRunning) {
+        mWorkerRunning = true;
+        std::thread(runWorker, shared_from_this()).detach();
+    }
+}
+
+void Disk::runWorker(std::shared_ptr<Disk> disk) {
+    while (true) {
+        std::function<void()> work;
+        {
+            std::lock_guard<std::mutex> lock(disk->mQueueLock);
+            if (disk->mQueue.empty()) {
+                disk->mWorkerRunning = false;
+                disk->mIdleCond.notify_all();
+                return;
+            }
+            work = std::move(disk->mQueue.front());
+            disk->mQueue.pop_front();
+        }
+        work();
+    }
+}
+
+void Disk::waitForIdle() {
+    std::unique_lock<std::mutex> lock(mQueueLock);
+    mIdleCond.wait(lock, [this] { return !mWorkerRunning; });
+}
+
+bool Disk::waitForIdle(nsecs_t deadline) {
+    std::unique_lock<std::mutex> lock(mQueueLock);
+    nsecs_t remaining = std::max<nsecs_t>(deadline - systemTime(SYSTEM_TIME_MONOTONIC), 0);
+    return mIdleCond.wait_for(lock, std::chrono::nanoseconds(remaining),
+            [this] { return !mWorkerRunning; });
+}
+
+void Disk::postCreate(const std::shared_ptr<Disk>& predecessor) {
+    post([this, predecessor] {
+        // Let a removed disk at the same device finish tearing down first
+        if (predecessor != nullptr) {
+            predecessor->waitForIdle();
+        }
+        mMediaTime = systemTime(SYSTEM_TIME_BOOTTIME);
+        create();
+    });
+}
+
+void Disk::postDestroy(nsecs_t deadline) {
+    post([this, deadline] {
+        SetUnmountDeadline(deadline);
+        destroy();
+        SetUnmountDeadline(0);
+    });
+}
+
+void Disk::postReset() {
+    post([this] {
+        destroy();
+        reset();
+    });
+}
+
+void Disk::postUnmountAll(nsecs_t deadline) {
+    post([this, deadline] {
+        SetUnmountDeadline(deadline);
+        unmountAll();
+        SetUnmountDeadline(0);
+    });
+}
+
+int Disk::postMountAll(int mountFlags, userid_t userId, size_t parallelism,
+        const MountProgress& progress) {
+    auto result = std::make_shared<std::promise<int>>();
+    std::future<int> failed = result->get_future();
+    post([this, result, mountFlags, userId, parallelism, progress] {
+        result->set_value(mountAll(mountFlags, userId, parallelism, progress));
+    });
+    return failed.get();
+}
+
+void Disk::postMediaChange() {
+    post([this] {
+        mMediaTime = systemTime(SYSTEM_TIME_BOOTTIME);
+        updateMediaGeneration();
+        if (isSrdiskMounted()) {
+            LOG(DEBUG) << "srdisk  ejected";
+            destroyAllVolumes();
+        }
+    });
+}
+
+void Disk::postBlockEvent(const std::shared_ptr<const BlockEvent>& evt) {
+    post([this, evt] { handleBlockEvent(*evt); });
+}
+
+void Disk::postAddPartition(int part) {
+    post([this, part] { addPartition(part); });
+}
+
+void Disk::updateMediaGeneration() {
+    // Golden ratio multiply, so nearby times spread out
+    mGeneration = (mMediaTime * 0x9e3779b97f4a7c15ULL) ^ mSize;
+
+    std::lock_guard<std::mutex> lock(mVolumesLock);
+    for (auto vol : mVolumes) {
+        vol->setMediaGeneration(mGeneration);
+    }
+}
+
 std::shared_ptr<VolumeBase> Disk::findVolume(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mVolumesLock);
     for (auto vol : mVolumes) {
         if (vol->getId() == id) {
             return vol;
@@ -135,6 +250,7 @@ std::shared_ptr<VolumeBase> Disk::findVolume(const std::string& id) {
 }
 
 void Disk::listVolumes(VolumeBase::Type type, std::list<std::string>& list) {
+    std::lock_guard<std::mutex> lock(mVolumesLock);
     for (auto vol : mVolumes) {
         if (vol->getType() == type) {
             list.push_back(vol->getId());
@@ -143,44 +259,42 @@ void Disk::listVolumes(VolumeBase::Type type, std::list<std::string>& list) {
     }
 }
 
+void Disk::listPartitions(std::vector<int>& parts) {
+    std::lock_guard<std::mutex> lock(mVolumesLock);
+    for (auto vol : mVolumes) {
+        parts.push_back(vol->getPartNo());
+    }
+}
+
 status_t Disk::create() {
     CHECK(!mCreated);
     mCreated = true;
-    notifyEvent(ResponseCode::DiskCreated, StringPrintf("%d", mFlags));
+    notifyEvent(ResponseCode::DiskCreated, static_cast<int64_t>(mFlags));
 
     // do nothing when srdisk is created
     if (mSrdisk)
         return OK;
 
     readDiskMetadata();
+    updateMediaGeneration();
     // sleep 10ms
     usleep(10000);
 
-    std::string fsType;
-    std::string unused;
-
-    // if no partition, handle here
-    if (ReadPartMetadata(mDevPath, fsType, unused, unused) == OK) {
-        if (!fsType.empty()) {
-            if (VolumeManager::Instance()->getDebug())
-                LOG(DEBUG) << "treat entire disk as partition, devPath=" << mDevPath;
-            createPublicVolume(mDevName, true, 0);
-        }
-    }
-
+    readPartitions();
     return OK;
 }
 
 status_t Disk::reset() {
     CHECK(!mCreated);
     mCreated = true;
-    notifyEvent(ResponseCode::DiskCreated, StringPrintf("%d", mFlags));
+    notifyEvent(ResponseCode::DiskCreated, static_cast<int64_t>(mFlags));
 
     // do nothing when srdisk is created
     if (mSrdisk)
         return OK;
 
     readDiskMetadata();
+    updateMediaGeneration();
 
     if (mPartNo.size() == 0) {
         createPublicVolume(mDevName, true, 0);
@@ -208,25 +322,6 @@ status_t Disk::destroy() {
     return OK;
 }
 
-void Disk::handleJustPublicPhysicalDevice(
-    const std::string& physicalDevName) {
-    auto vol = std::shared_ptr<VolumeBase>(new PublicVolume(physicalDevName, true));
-    if (mJustPartitioned) {
-        LOG(DEBUG) << "Device just partitioned; silently formatting";
-        vol->setSilent(true);
-        vol->create();
-        vol->format("auto");
-        vol->destroy();
-        vol->setSilent(false);
-    }
-
-    mVolumes.push_back(vol);
-    vol->setDiskId(getId());
-    vol->setSysPath(getSysPath());
-    vol->create();
-    //vol->mount();
-}
-
 void Disk::createPublicVolume(const std::string& partDevName,
         const bool isPhysical, int part) {
     auto vol = std::shared_ptr<VolumeBase>(new PublicVolume(partDevName, isPhysical));
@@ -239,21 +334,95 @@ void Disk::createPublicVolume(const std::string& partDevName,
         vol->setSilent(false);
     }
 
-    mVolumes.push_back(vol);
     vol->setDiskId(getId());
     vol->setSysPath(getSysPath());
     vol->setDiskFlags(mFlags);
     vol->setPartNo(part);
+    const PartitionTable::Partition* info = part > 0 ? mPartTable.find(part) : nullptr;
+    if (info != nullptr) {
+        vol->setPartGuid(info->partGuid);
+    }
+    vol->setDiskDevice(mDevice);
+    vol->setMediaGeneration(mGeneration);
+    {
+        std::lock_guard<std::mutex> lock(mVolumesLock);
+        mVolumes.push_back(vol);
+    }
+    VolumeManager::Instance()->indexVolume(vol);
 
     vol->create();
     //vol->mount();
 }
 
 void Disk::destroyAllVolumes() {
-    for (auto vol : mVolumes) {
+    std::vector<std::shared_ptr<VolumeBase>> volumes;
+    {
+        std::lock_guard<std::mutex> lock(mVolumesLock);
+        volumes.swap(mVolumes);
+    }
+
+    for (auto vol : volumes) {
+        VolumeManager::Instance()->unindexVolume(vol);
         vol->destroy();
     }
-    mVolumes.clear();
+}
+
+int Disk::mountAll(int mountFlags, userid_t userId, size_t parallelism,
+        const MountProgress& progress) {
+    std::vector<std::shared_ptr<VolumeBase>> volumes;
+    {
+        std::lock_guard<std::mutex> lock(mVolumesLock);
+        for (auto vol : mVolumes) {
+            if (vol->getState() == VolumeBase::State::kUnmounted) {
+                volumes.push_back(vol);
+            }
+        }
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    // Serializes progress reports so done never goes backwards
+    std::mutex progressLock;
+    uint64_t done = 0;
+    auto mountNext = [&] {
+        size_t i;
+        while ((i = next++) < volumes.size()) {
+            auto& vol = volumes[i];
+            nsecs_t before = systemTime(SYSTEM_TIME_MONOTONIC);
+            vol->setMountFlags(mountFlags);
+            vol->setMountUserId(userId);
+            status_t res = vol->mount();
+            if (res != OK) {
+                failed++;
+            }
+            nsecs_t ms = (systemTime(SYSTEM_TIME_MONOTONIC) - before) / 1000000;
+            LOG(INFO) << mId << " mounted " << vol->getId() << " in " << ms << "ms: " << res;
+            notifyEvent(StorageEvent(ResponseCode::DiskVolumeMounted, "")
+                    .add(vol->getId()).add(res).add(ms));
+            if (progress) {
+                std::lock_guard<std::mutex> lock(progressLock);
+                progress(++done, volumes.size());
+            }
+        }
+    };
+
+    // The calling thread takes its share too
+    std::vector<std::thread> threads;
+    size_t helpers = std::min(std::max(parallelism, (size_t) 1), volumes.size());
+    for (size_t i = 1; i < helpers; i++) {
+        threads.emplace_back(mountNext);
+    }
+    mountNext();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    nsecs_t ms = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1000000;
+    LOG(INFO) << mId << " mounted " << volumes.size() << " volumes in " << ms << "ms";
+    notifyEvent(StorageEvent(ResponseCode::DiskAllMounted, "")
+            .addUnsigned(volumes.size()).add(failed.load()).add(ms));
+    return failed;
 }
 
 status_t Disk::readDiskMetadata() {
@@ -315,178 +484,104 @@ status_t Disk::readDiskMetadata() {
     }
     }
 
-    notifyEvent(ResponseCode::DiskSizeChanged, StringPrintf("%" PRIu64, mSize));
+    notifyEvent(StorageEvent(ResponseCode::DiskSizeChanged, "").addUnsigned(mSize));
     notifyEvent(ResponseCode::DiskLabelChanged, mLabel);
     notifyEvent(ResponseCode::DiskSysPathChanged, mSysPath);
     return OK;
 }
 
-void Disk::handleBlockEvent(NetlinkEvent *evt) {
-    std::string eventPath(evt->findParam("DEVPATH")?evt->findParam("DEVPATH"):"");
-    std::string devName(evt->findParam("DEVNAME")?evt->findParam("DEVNAME"):"");
-    std::string devType(evt->findParam("DEVTYPE")?evt->findParam("DEVTYPE"):"");
+void Disk::addPartition(int part) {
+    // A resync or the startup scan may report a partition we already have
+    if (std::find(mPartNo.begin(), mPartNo.end(), part) != mPartNo.end()) {
+        LOG(DEBUG) << mId << " already has partition " << part;
+        return;
+    }
+    const PartitionTable::Partition* info = mPartTable.find(part);
+    if (info != nullptr && !isVolumePartition(*info)) {
+        LOG(DEBUG) << mId << " has no volume on partition " << part;
+        return;
+    }
 
+    std::string partDevName;
+    mPartNo.push_back(part);
+    if (mFlags & Flags::kUsb)
+        partDevName = StringPrintf("%s%d", mDevName.c_str(), part);
+    else if (mFlags & Flags::kSd)
+        partDevName = StringPrintf("%sp%d", mDevName.c_str(), part);
+
+    LOG(INFO) << " partDevName =" << partDevName;
+    createPublicVolume(partDevName, false, part);
+}
+
+void Disk::handleBlockEvent(const BlockEvent& evt) {
     // can we handle this event
-    if (eventPath.find(mEventPath) == std::string::npos) {
+    if (!evt.devPath.isBelow(mEventPath)) {
         LOG(DEBUG) << "evt will handle by other disk " << mEventPath;
         return;
     }
 
-    if (devType != "partition") {
-        LOG(DEBUG) << "evt type is not partition " << devType;
-        evt->dump();
+    if (evt.type != BlockEvent::Type::kPartition) {
+        LOG(DEBUG) << "evt type is not partition " << evt.devType.data;
+        evt.event->dump();
         return;
     }
 
-    std::string partDevName;
-    switch (evt->getAction()) {
+    switch (evt.action) {
     case NetlinkEvent::Action::kAdd: {
-        int part = atoi(evt->findParam("PARTN"));
-
-        mPartNo.push_back(part);
-        if (mFlags & Flags::kUsb)
-            partDevName = StringPrintf("%s%d", mDevName.c_str(), part);
-        else if (mFlags & Flags::kSd)
-            partDevName = StringPrintf("%sp%d", mDevName.c_str(), part);
-
-        LOG(INFO) << " partDevName =" << partDevName;
-        createPublicVolume(partDevName, false, part);
+        addPartition(evt.partN);
         break;
     }
     case NetlinkEvent::Action::kChange: {
-        // ignore
         LOG(DEBUG) << "Disk at " << mDevPath << " changed";
+        ProbeCache::Instance()->invalidate(evt.getDevice());
         break;
     }
     case NetlinkEvent::Action::kRemove: {
         // will handle by vm
+        ProbeCache::Instance()->invalidate(evt.getDevice());
         break;
     }
     default: {
-        LOG(WARNING) << "Unexpected block event action " << (int) evt->getAction();
+        LOG(WARNING) << "Unexpected block event action " << (int) evt.action;
         break;
     }
     }
 }
 
-#if 0
 status_t Disk::readPartitions() {
     if (mSrdisk) {
         // srdisk has no partiton concept.
         LOG(INFO) << "srdisk try entire disk as fake partition";
-        //createPublicVolume(mDevice);
         return OK;
     }
 
-    int8_t maxMinors = getMaxMinors();
-    if (maxMinors < 0) {
-        return -ENOTSUP;
-    }
-
-    destroyAllVolumes();
-
     // Parse partition table
-
-    std::vector<std::string> cmd;
-    cmd.push_back(kSgdiskPath);
-    cmd.push_back("--android-dump");
-    cmd.push_back(mDevPath);
-
-    std::vector<std::string> output;
-    status_t res = ForkExecvp(cmd, output);
-    if (res != OK) {
-        LOG(WARNING) << "sgdisk failed to scan " << mDevPath;
-        notifyEvent(ResponseCode::DiskScanned);
-        mJustPartitioned = false;
-        return res;
-    }
-
-    Table table = Table::kUnknown;
-    bool foundParts = false;
-    std::string physicalDevName, partDevName;
-    for (auto line : output) {
-        char* cline = (char*) line.c_str();
-        char* token = strtok(cline, kSgdiskToken);
-        if (token == nullptr) continue;
-
-        if (!strcmp(token, "DISK")) {
-            const char* type = strtok(nullptr, kSgdiskToken);
-            if (!strcmp(type, "mbr")) {
-                table = Table::kMbr;
-            } else if (!strcmp(type, "gpt")) {
-                table = Table::kGpt;
-            }
-        } else if (!strcmp(token, "PART")) {
-            foundParts = true;
-            int i = strtol(strtok(nullptr, kSgdiskToken), nullptr, 10);
-            if (i <= 0 || i > maxMinors) {
-                LOG(WARNING) << mId << " is ignoring partition " << i
-                        << " beyond max supported devices";
-                continue;
-            }
-            dev_t partDevice = makedev(major(mDevice), minor(mDevice) + i);
-
-            if (mFlags & Flags::kUsb)
-                partDevName = StringPrintf("%s%d", mDevName.c_str(), i);
-            else if (mFlags & Flags::kSd)
-                partDevName = StringPrintf("%sp%d", mDevName.c_str(), i);
-            LOG(INFO) << " partDevName =" << partDevName;
-
-            if (table == Table::kMbr) {
-                const char* type = strtok(nullptr, kSgdiskToken);
-
-                if (IsJustPhysicalDevice(mSysPath, physicalDevName)) {
-                    LOG(INFO) << " here,we don't create public:xx,xx for physical device only!";
-                    handleJustPublicPhysicalDevice(physicalDevName);
-                    break;
-                }
-
-                // support mort than 16 partitions
-                if (i > 15)
-                    getPhysicalDev(partDevice, mSysPath, i);
-
-                switch (strtol(type, nullptr, 16)) {
-                case 0x06: // FAT16
-                case 0x0b: // W95 FAT32 (LBA)
-                case 0x0c: // W95 FAT32 (LBA)
-                case 0x0e: // W95 FAT16 (LBA)
-
-                case 0x07: // NTFS & EXFAT
-                    createPublicVolume(partDevName, false);
-                    break;
-
-                default:
-                    // We should still create public volume here
-                    // cause some disk table types are not matched above
-                    // but can be mounted successfully
-                    createPublicVolume(partDevName, false);
-                    LOG(WARNING) << "unsupported table kMbr type " << type;
-                    break;
-                }
-            } else if (table == Table::kGpt) {
-                const char* typeGuid = strtok(nullptr, kSgdiskToken);
-                const char* partGuid = strtok(nullptr, kSgdiskToken);
-
-                if (!strcasecmp(typeGuid, kGptBasicData)) {
-                    createPublicVolume(partDevName, false);
-                }
-            }
-        }
-    }
+    PartitionTable table;
+    if (ReadPartitionTable(mDevPath, table) != OK) {
+        LOG(WARNING) << "Failed to scan partition table of " << mDevPath;
+    }
+    mPartTable = table;
+    LOG(INFO) << mId << " has a " << (table.type == PartitionTable::Type::kGpt ? "gpt" :
+            table.type == PartitionTable::Type::kMbr ? "mbr" : "unknown") << " table with "
+            << table.partitions.size() << " partitions" << (table.hybrid ? " (hybrid)" : "")
+            << (table.backup ? " (backup)" : "");
+
+    // The volumes themselves are created by the partition uevents that
+    // follow, or the startup scan, once their device nodes exist; the
+    // table only decides which partitions get one
+    bool foundParts = std::any_of(table.partitions.begin(), table.partitions.end(),
+            [](const PartitionTable::Partition& part) { return isVolumePartition(part); });
 
     // Ugly last ditch effort, treat entire disk as partition
-    if (table == Table::kUnknown || !foundParts) {
-        LOG(WARNING) << mId << " has unknown partition table; trying entire device";
-
+    if (!foundParts) {
         std::string fsType;
         std::string unused;
-        if (ReadPartMetadata(mDevPath, fsType, unused, unused) == OK) {
-            if (IsJustPhysicalDevice(mSysPath, physicalDevName)) {
-                handleJustPublicPhysicalDevice(physicalDevName);
-            } else {
-                createPublicVolume(partDevName, false);
-            }
-        } else {
+        if (ReadPartMetadata(mDevPath, mDevice, mGeneration, fsType, unused, unused) == OK
+                && !fsType.empty()) {
+            if (VolumeManager::Instance()->getDebug())
+                LOG(DEBUG) << "treat entire disk as partition, devPath=" << mDevPath;
+            createPublicVolume(mDevName, true, 0);
+        } else if (table.type == PartitionTable::Type::kUnknown) {
             LOG(WARNING) << mId << " failed to identify, giving up";
         }
     }
@@ -495,23 +590,35 @@ status_t Disk::readPartitions() {
     mJustPartitioned = false;
     return OK;
 }
-#endif
 
 status_t Disk::unmountAll() {
     for (auto vol : mVolumes) {
-        vol->unmount();
+        if (vol->getState() != VolumeBase::State::kMounted) {
+            continue;
+        }
+        nsecs_t before = systemTime(SYSTEM_TIME_MONOTONIC);
+        status_t res = vol->unmount();
+        nsecs_t ms = (systemTime(SYSTEM_TIME_MONOTONIC) - before) / 1000000;
+        LOG(INFO) << mId << " unmounted " << vol->getId() << " in " << ms << "ms: " << res;
     }
     return OK;
 }
 
 void Disk::notifyEvent(int event) {
-    VolumeManager::Instance()->getBroadcaster()->sendBroadcast(event,
-            getId());
+    notifyEvent(StorageEvent(event, ""));
 }
 
 void Disk::notifyEvent(int event, const std::string& value) {
-    VolumeManager::Instance()->getBroadcaster()->sendBroadcast(event,
-            StringPrintf("%s %s", getId().c_str(), value.c_str()));
+    notifyEvent(StorageEvent(event, "").add(value));
+}
+
+void Disk::notifyEvent(int event, int64_t value) {
+    notifyEvent(StorageEvent(event, "").add(value));
+}
+
+void Disk::notifyEvent(StorageEvent event) {
+    event.setId(getId());
+    VolumeManager::Instance()->getBroadcaster()->sendBroadcast(event);
 }
 
 
@@ -560,24 +667,5 @@ int Disk::getMaxMinors() {
     return -ENOTSUP;
 }
 
-void Disk::getPhysicalDev(dev_t &device, const std:: string& sysPath, int part) {
-    std::string smajor, sminor;
-    std::string physicalDev, lpDev;
-    int major, minor;
-
-    if (part <= 15)
-        return;
-
-    if (GetPhysicalDevice(sysPath, physicalDev) == OK) {
-        lpDev =  StringPrintf("%s%d", physicalDev.c_str(), part);
-        if (!access(lpDev.c_str(), F_OK) &&
-                readBlockDevMajorAndMinor(lpDev, smajor, sminor) == OK) {
-            major = atoi(smajor.c_str());
-            minor = atoi(sminor.c_str());
-            device = makedev(major, minor);
-        }
-    }
-}
-
 }  // namespace vold
 }  // namespace android
@@ -17,12 +17,21 @@
 #ifndef ANDROID_VOLD_DISK_H
 #define ANDROID_VOLD_DISK_H
 
+#include "BlockEvent.h"
+#include "PartitionTable.h"
+#include "StorageEvent.h"
 #include "Utils.h"
 #include "VolumeBase.h"
 
 #include <utils/Errors.h>
 #include <sysutils/NetlinkEvent.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace android {
@@ -35,8 +44,13 @@ class VolumeBase;
  *
  * Knows how to create volumes based on the partition tables found, and also
  * how to repartition itself.
+ *
+ * All work that touches the media or the volume list runs in order on a
+ * per-disk worker thread, so a slow device only delays its own events.
+ * The worker is spawned when work is posted and exits once the queue is
+ * drained.
  */
-class Disk {
+class Disk : public std::enable_shared_from_this<Disk> {
 public:
     Disk(const std::string& eventPath, dev_t device, const std::string& nickname,
             const std::string& eventName, int flags);
@@ -62,29 +76,72 @@ public:
     const std::string& getDevPath() { return mDevPath; }
     dev_t getDevice() { return mDevice; }
     uint64_t getSize() { return mSize; }
+    uint64_t getMediaGeneration() { return mGeneration; }
     const std::string& getLabel() { return mLabel; }
     int getFlags() { return mFlags; }
 
     std::shared_ptr<VolumeBase> findVolume(const std::string& id);
 
     void listVolumes(VolumeBase::Type type, std::list<std::string>& list);
+    /* Partition numbers that currently have a volume, 0 for the whole disk */
+    void listPartitions(std::vector<int>& parts);
 
     status_t create();
     status_t destroy();
 
     status_t readDiskMetadata();
+    /*
+     * Creates a volume for every partition in the table at once, or for
+     * the whole disk if it has none but carries a filesystem.
+     */
     status_t readPartitions();
 
     status_t unmountAll();
+    /* Reports that done of total volumes have been attempted */
+    typedef std::function<void(uint64_t done, uint64_t total)> MountProgress;
+    /*
+     * Mounts every unmounted volume on this disk, up to parallelism at
+     * once, and returns how many failed. Per-volume timings are broadcast.
+     * Runs on the worker, see postMountAll(); its helper threads are all
+     * joined before it returns.
+     */
+    int mountAll(int mountFlags, userid_t userId, size_t parallelism,
+            const MountProgress& progress = nullptr);
 
     bool isSrdiskMounted();
     void notifyEvent(int msg);
     void notifyEvent(int msg, const std::string& value);
+    void notifyEvent(int msg, int64_t value);
+    /* For events with several arguments; the ID is filled in here */
+    void notifyEvent(StorageEvent event);
     void destroyAllVolumes();
 
-    void handleBlockEvent(NetlinkEvent *evt);
+    void handleBlockEvent(const BlockEvent& evt);
+    /* Creates the volume for partition number part, if not present yet */
+    void addPartition(int part);
     status_t reset();
 
+    /* Asynchronous variants, run on this disk's worker */
+    void postCreate(const std::shared_ptr<Disk>& predecessor);
+    /* deadline bounds unmounting volumes that are still mounted, 0 for none */
+    void postDestroy(nsecs_t deadline = 0);
+    void postReset();
+    /* Stops escalating and detaches lazily once deadline passes, 0 for none */
+    void postUnmountAll(nsecs_t deadline);
+    /*
+     * Runs mountAll() on the worker, so no uevent destroys a volume while
+     * it is being mounted, and waits for the number of failures.
+     */
+    int postMountAll(int mountFlags, userid_t userId, size_t parallelism,
+            const MountProgress& progress);
+    void postMediaChange();
+    void postBlockEvent(const std::shared_ptr<const BlockEvent>& evt);
+    void postAddPartition(int part);
+    /* Blocks until all posted work has finished */
+    void waitForIdle();
+    /* Same, but gives up at deadline and returns false if still busy */
+    bool waitForIdle(nsecs_t deadline);
+
 private:
     /* ID that uniquely references this disk */
     std::string mId;
@@ -100,6 +157,13 @@ private:
     dev_t mDevice;
     /* Size of disk, in bytes */
     uint64_t mSize;
+    /*
+     * Boot clock time the worker took up the current media. Workers run
+     * one task at a time, so every add or change gets a distinct value.
+     */
+    nsecs_t mMediaTime;
+    /* Derived from mMediaTime and mSize; keys the probe cache */
+    std::atomic<uint64_t> mGeneration;
     /* User-visible label, such as manufacturer */
     std::string mLabel;
     /* Current partitions on disk */
@@ -116,12 +180,25 @@ private:
     bool mSrdisk;
 
     std::vector<int> mPartNo;
+    /* Layout found by readPartitions(), for partition GUIDs and types */
+    PartitionTable mPartTable;
+
+    /* Protects mVolumes against readers outside the worker */
+    std::mutex mVolumesLock;
+
+    std::mutex mQueueLock;
+    std::condition_variable mIdleCond;
+    std::deque<std::function<void()>> mQueue;
+    bool mWorkerRunning;
+
+    void post(std::function<void()> work);
+    /* Recomputes mGeneration and hands it to every volume */
+    void updateMediaGeneration();
+    static void runWorker(std::shared_ptr<Disk> disk);
 
     void createPublicVolume(const std::string& partDevName,
             const bool isPhysical, int part);
     void createPrivateVolume(dev_t device, const std::string& partGuid);
-    void handleJustPublicPhysicalDevice(const std::string& physicalDevName);
-    void getPhysicalDev(dev_t &device, const std:: string& sysPath, int part);
 
     int getMaxMinors();
 
@@ -22,7 +22,18 @@
 #include <android-base/stringprintf.h>
 #include <cutils/fs.h>
 #include <cutils/log.h>
-
+#include <cutils/properties.h>
+#include <HidlTransportSupport.h>
+
+#include <inttypes.h>
+#include <algorithm>
+#include <stdio.h>
+#include <thread>
+
+#include "BlockTopology.h"
+#include "Checksum.h"
+#include "FsProbe.h"
+#include "NetlinkManager.h"
 #include "VolumeManager.h"
 
 namespace vendor {
@@ -40,8 +51,38 @@ DroidVold *DroidVold::Instance() {
     return sInstance;
 }
 
-DroidVold::DroidVold() {
-    mCallback = NULL;
+/* Volume jobs that may run at once, each on a different volume */
+static const int kDefaultJobThreads = 2;
+/* Broadcasts queued for the callback before the overflow policy applies */
+static const int kDefaultEventQueueDepth = 256;
+/* Records in a client's shared event ring, 256 bytes each */
+static const int kDefaultEventRingDepth = 512;
+/* Past events kept for reconnecting clients */
+static const int kDefaultEventHistory = 1024;
+
+DroidVold::DroidVold() :
+        mState(std::max(property_get_int32("droidvold.event_history",
+                kDefaultEventHistory), 1)) {
+    mNextClientId = 1;
+    mFrameworkClientId = 0;
+    mDeathRecipient = new ClientDeathRecipient(this);
+
+    char policy[PROPERTY_VALUE_MAX];
+    property_get("droidvold.event_overflow", policy, "drop_oldest");
+    mDispatcher.reset(new android::droidvold::EventDispatcher(
+            [this](const std::vector<android::droidvold::StorageEvent>& events) {
+                deliverBroadcast(events);
+            },
+            std::max(property_get_int32("droidvold.event_queue_depth",
+                    kDefaultEventQueueDepth), 1),
+            android::droidvold::EventDispatcher::parseOverflow(policy)));
+    mDispatcher->start();
+
+    mJobs.reset(new android::droidvold::JobExecutor(
+            property_get_int32("droidvold.job_threads", kDefaultJobThreads),
+            [this](const android::droidvold::StorageEvent& event) {
+                sendBroadcast(event);
+            }));
 }
 
 DroidVold::~DroidVold() {
@@ -51,16 +92,181 @@ Return<void> DroidVold::setCallback(const sp<IDroidVoldCallback>& callback) {
     if (VolumeManager::Instance()->getDebug())
         LOG(DEBUG) << "setCallback =" << callback.get();
 
-    /*
+    // The framework's callback replaces its previous one, NULL clears it
+    uint64_t id = 0;
+    if (callback != NULL) {
+        id = addCallback(callback, kNoReplay);
+    }
+    uint64_t previous;
+    {
+        android::Mutex::Autolock _l(mLock);
+        previous = mFrameworkClientId;
+        mFrameworkClientId = id;
+    }
+    if (previous != 0 && previous != id) {
+        removeCallback(previous);
+    }
+    return Void();
+}
+
+Return<uint64_t> DroidVold::addCallback(const sp<IDroidVoldCallback>& callback,
+        uint64_t lastSeq) {
+    // No broadcast may slip in between the replay and going live
+    android::Mutex::Autolock _b(mBroadcastLock);
+    android::Mutex::Autolock _l(mLock);
+    auto existing = findClientLocked(callback);
+    if (existing != nullptr) {
+        return existing->id;
+    }
+
+    std::vector<android::droidvold::StorageEvent> replay;
+    if (lastSeq != kNoReplay && !mState.getEventsSince(lastSeq, replay)) {
+        LOG(INFO) << "Events after " << lastSeq << " are gone, replaying state instead";
+        mState.getSnapshotEvents(replay);
+    }
+
+    auto client = std::make_shared<Client>();
+    client->id = mNextClientId++;
+    client->callback = callback;
+    client->replayedThrough = mState.getSequence();
+    client->droppedSeen = 0;
+    client->resyncedThrough = 0;
+    Client* c = client.get();
+    client->queue.reset(new android::droidvold::EventDispatcher(
+            [this, c](const std::vector<android::droidvold::StorageEvent>& events) {
+                deliverToClient(c, events);
+            },
+            // Room for the replay on top of the usual backlog
+            std::max(property_get_int32("droidvold.event_queue_depth",
+                    kDefaultEventQueueDepth), 1) + replay.size(),
+            // Never block, the dispatcher thread feeds every client in turn
+            android::droidvold::EventDispatcher::Overflow::kDropOldest));
+    client->queue->start();
+    for (auto& event : replay) {
+        client->queue->send(event);
+    }
+
+    auto linked = callback->linkToDeath(mDeathRecipient, client->id);
+    if (!linked.isOk() || !linked) {
+        LOG(WARNING) << "Failed to watch client " << client->id << " for death";
+    }
+
+    LOG(INFO) << "Added event client " << client->id;
+    mClients.push_back(client);
+    return client->id;
+}
+
+Return<void> DroidVold::removeCallback(uint64_t clientId) {
+    std::shared_ptr<Client> removed;
+    {
+        android::Mutex::Autolock _l(mLock);
+        auto it = std::find_if(mClients.begin(), mClients.end(),
+                [clientId](const std::shared_ptr<Client>& c) { return c->id == clientId; });
+        if (it == mClients.end()) {
+            return Void();
+        }
+        removed = *it;
+        mClients.erase(it);
+    }
+
+    LOG(INFO) << "Removed event client " << clientId;
+    removed->callback->unlinkToDeath(mDeathRecipient);
+    // Stopping joins the client's thread, which may be stuck in onEvent to
+    // a wedged client; leave that wait to a thread of its own
+    std::thread([removed] { removed->queue->stop(); }).detach();
+    return Void();
+}
+
+std::shared_ptr<DroidVold::Client> DroidVold::findClientLocked(
+        const sp<IDroidVoldCallback>& callback) {
+    // Each transaction brings a new proxy for the same remote callback
+    for (auto& client : mClients) {
+        if (android::hardware::interfacesEqual(client->callback, callback)) {
+            return client;
+        }
+    }
+    return nullptr;
+}
+
+void DroidVold::deliverToClient(Client* client,
+        const std::vector<android::droidvold::StorageEvent>& events) {
+    std::vector<android::droidvold::StorageEvent> batch;
+    uint64_t dropped = client->queue->getDroppedCount();
+    if (dropped != client->droppedSeen) {
+        // The gap is before this batch; a 1.0 client can't tell, so send
+        // it the whole state again and skip what that already covers
+        LOG(WARNING) << "Event client " << client->id << " lost "
+                << dropped - client->droppedSeen << " events, resending state";
+        client->droppedSeen = dropped;
+        mState.getSnapshotEvents(batch);
+        client->resyncedThrough = batch.front().getSeq();
+    }
+    for (auto& event : events) {
+        if (event.getSeq() > client->resyncedThrough) {
+            batch.push_back(event);
+        }
+    }
+    if (batch.empty()) {
+        return;
+    }
+
+    auto channel = std::atomic_load(&client->channel);
+    if (channel != nullptr) {
+        channel->write(batch);
+        return;
+    }
+    // IDroidVoldCallback 1.0 takes one formatted event per call
+    for (auto& event : batch) {
+        auto ret = client->callback->onEvent(event.getCode(), hidl_string(event.toString()));
+        if (!ret.isOk()) {
+            LOG(WARNING) << "Failed to deliver event " << event.getCode() << ": "
+                    << ret.description();
+            return;
+        }
+    }
+}
+
+Return<void> DroidVold::openEventQueue(const sp<IDroidVoldCallback>& callback,
+        openEventQueue_cb _hidl_cb) {
+    std::shared_ptr<android::droidvold::EventChannel> channel;
     if (callback != NULL) {
-        mClients.push_back(callback);
+        // A callback already registered, e.g. the framework's through
+        // setCallback(), moves onto the ring instead of gaining a second client
+        addCallback(callback, kNoReplay);
+
+        android::Mutex::Autolock _l(mLock);
+        auto client = findClientLocked(callback);
+        if (client != nullptr) {
+            channel = std::atomic_load(&client->channel);
+            if (channel == nullptr) {
+                channel = std::make_shared<android::droidvold::EventChannel>(std::max(
+                        property_get_int32("droidvold.event_ring_depth",
+                                kDefaultEventRingDepth), 1));
+                if (channel->isValid()) {
+                    std::atomic_store(&client->channel, channel);
+                    LOG(INFO) << "Event client " << client->id << " switched to a "
+                            << channel->getCapacity() << " record queue";
+                } else {
+                    channel.reset();
+                }
+            }
+        }
     }
-    */
 
-    mCallback = callback;
+    if (channel == nullptr) {
+        _hidl_cb(Result::FAIL, android::hardware::MQDescriptorSync<EventRecord>());
+    } else {
+        _hidl_cb(Result::OK, *channel->getDesc());
+    }
     return Void();
 }
 
+void DroidVold::ClientDeathRecipient::serviceDied(uint64_t cookie,
+        const android::wp<::android::hidl::base::V1_0::IBase>& who) {
+    LOG(WARNING) << "Event client " << cookie << " died";
+    mDroidVold->removeCallback(cookie);
+}
+
 Return<Result> DroidVold::reset() {
     VolumeManager *vm = VolumeManager::Instance();
     vm->reset();
@@ -163,22 +369,204 @@ Return<Result> DroidVold::format(const hidl_string& id, const hidl_string& type)
     return Result::OK;
 }
 
-void DroidVold::sendBroadcast(int event, const std::string& message) {
+Return<void> DroidVold::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& args) {
+    if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
+        return Void();
+    }
+    int out = fd->data[0];
+
+    NetlinkManager *nm = NetlinkManager::Instance();
+    dprintf(out, "uevent filter: %s\n", nm->isFilterAttached() ? "attached" : "none");
+    dprintf(out, "uevents delivered: %" PRIu64 "\n", nm->getDeliveredCount());
+    dprintf(out, "uevents filtered: %" PRIu64 "\n", nm->getFilteredCount());
+    dprintf(out, "uevents collapsed: %" PRIu64 "\n", nm->getCollapsedCount());
+    dprintf(out, "uevent socket buffer: %d\n", nm->getReceiveBufferSize());
+    dprintf(out, "uevent socket overflows: %" PRIu64 "\n", nm->getOverflowCount());
+    dprintf(out, "sysfs resyncs: %" PRIu64 "\n", nm->getResyncCount());
+
+    dprintf(out, "volume jobs: %zu running, %zu pending\n", mJobs->getRunningCount(),
+            mJobs->getPendingCount());
+    dprintf(out, "event queue: %zu/%zu, max %zu\n", mDispatcher->getDepth(),
+            mDispatcher->getCapacity(), mDispatcher->getMaxDepth());
+    dprintf(out, "events delivered: %" PRIu64 ", dropped: %" PRIu64 "\n",
+            mDispatcher->getDeliveredCount(), mDispatcher->getDroppedCount());
+    dprintf(out, "event latency: avg %.3f ms, max %.3f ms\n",
+            mDispatcher->getAverageLatency() / 1e6, mDispatcher->getMaxLatency() / 1e6);
+    dprintf(out, "event sequence: %" PRIu64 "\n", mState.getSequence());
+    {
+        android::Mutex::Autolock _l(mLock);
+        for (auto& client : mClients) {
+            auto& queue = client->queue;
+            dprintf(out, "client %" PRIu64 ": queued %zu, delivered %" PRIu64 ", dropped %"
+                    PRIu64 ", max latency %.3f ms\n", client->id, queue->getDepth(),
+                    queue->getDeliveredCount(), queue->getDroppedCount(),
+                    queue->getMaxLatency() / 1e6);
+            auto channel = std::atomic_load(&client->channel);
+            if (channel != nullptr) {
+                dprintf(out, "  event ring: %zu records, written %" PRIu64 ", dropped %"
+                        PRIu64 ", truncated %" PRIu64 "\n", channel->getCapacity(),
+                        channel->getWrittenCount(), channel->getDroppedCount(),
+                        channel->getTruncatedCount());
+            }
+        }
+    }
+
+    std::vector<android::droidvold::StorageState::Disk> disks;
+    std::vector<android::droidvold::StorageState::Volume> volumes;
+    mState.getState(disks, volumes);
+    for (auto& disk : disks) {
+        dprintf(out, "%s: flags %d, size %" PRIu64 ", label \"%s\", %s\n", disk.id.c_str(),
+                disk.flags, disk.size, disk.label.c_str(), disk.sysPath.c_str());
+    }
+    for (auto& vol : volumes) {
+        dprintf(out, "%s: type %d, disk %s, state %d, %s \"%s\" %s, %s\n", vol.id.c_str(),
+                vol.type, vol.diskId.c_str(), vol.state, vol.fsType.c_str(),
+                vol.fsLabel.c_str(), vol.fsUuid.c_str(), vol.path.c_str());
+    }
+
+    VolumeManager *vm = VolumeManager::Instance();
+    dprintf(out, "disks at boot: %zu\n", vm->getBootDiskCount());
+    if (vm->getStorageReadyTime() < 0) {
+        dprintf(out, "storage ready: pending\n");
+    } else {
+        dprintf(out, "storage ready: %.3f ms\n", vm->getStorageReadyTime() / 1e6);
+    }
+
+    android::droidvold::ProbeCache* probes = android::droidvold::ProbeCache::Instance();
+    dprintf(out, "probe cache: %zu entries, %" PRIu64 " hits, %" PRIu64 " misses\n",
+            probes->size(), probes->getHits(), probes->getMisses());
+    android::droidvold::BlockTopology* topology = android::droidvold::BlockTopology::Instance();
+    dprintf(out, "block topology: %zu devices, %" PRIu64 " scans\n", topology->size(),
+            topology->getScanCount());
+    dprintf(out, "crc: %s\n", android::droidvold::GetCrcImplementation());
+
+    return Void();
+}
+
+// Disk a volume job conflicts with, empty for loop volumes
+static std::string findDiskId(const std::string& volId) {
+    auto vol = VolumeManager::Instance()->findVolume(volId);
+    return vol != nullptr ? vol->getDiskId() : "";
+}
+
+Return<uint64_t> DroidVold::mountAsync(const hidl_string& id, uint32_t flag, uint32_t uid) {
+    std::string vid = id;
+    return mJobs->submit("mount", vid, findDiskId(vid),
+            [this, vid, flag, uid](const android::droidvold::JobExecutor::Progress&) {
+        Result res = mount(vid, flag, uid);
+        return res == Result::OK ? android::OK : -EIO;
+    });
+}
+
+Return<uint64_t> DroidVold::unmountAsync(const hidl_string& id) {
+    std::string vid = id;
+    return mJobs->submit("unmount", vid, findDiskId(vid),
+            [this, vid](const android::droidvold::JobExecutor::Progress&) {
+        Result res = unmount(vid);
+        return res == Result::OK ? android::OK : -EIO;
+    });
+}
+
+Return<uint64_t> DroidVold::formatAsync(const hidl_string& id, const hidl_string& type) {
+    std::string vid = id;
+    std::string fsType = type;
+    return mJobs->submit("format", vid, findDiskId(vid),
+            [this, vid, fsType](const android::droidvold::JobExecutor::Progress&) {
+        Result res = format(vid, fsType);
+        return res == Result::OK ? android::OK : -EIO;
+    });
+}
+
+Return<Result> DroidVold::mountAll(const hidl_string& diskId, uint32_t flag, uint32_t uid) {
+    int failed = VolumeManager::Instance()->mountAll(diskId, flag, uid);
+    if (failed != 0) {
+        LOG(ERROR) << "mountAll " << diskId << " failed: " << failed;
+        return Result::FAIL;
+    }
+    return Result::OK;
+}
+
+Return<uint64_t> DroidVold::mountAllAsync(const hidl_string& diskId, uint32_t flag,
+        uint32_t uid) {
+    std::string did = diskId;
+    // Holds the whole disk, so no single-volume job on it runs meanwhile
+    return mJobs->submit("mountall", "", did,
+            [did, flag, uid](const android::droidvold::JobExecutor::Progress& progress)
+                    -> android::status_t {
+        int failed = VolumeManager::Instance()->mountAll(did, flag, uid, progress);
+        if (failed != 0) {
+            LOG(ERROR) << "mountAll " << did << " failed: " << failed;
+            return failed < 0 ? failed : -EIO;
+        }
+        return android::OK;
+    });
+}
+
+Return<Result> DroidVold::cancelJob(uint64_t jobId) {
+    return mJobs->cancel(jobId) == android::OK ? Result::OK : Result::FAIL;
+}
+
+Return<void> DroidVold::getState(getState_cb _hidl_cb) {
+    std::vector<android::droidvold::StorageState::Disk> disks;
+    std::vector<android::droidvold::StorageState::Volume> volumes;
+    uint64_t seq = mState.getState(disks, volumes);
+
+    hidl_vec<DiskState> diskStates;
+    diskStates.resize(disks.size());
+    for (size_t i = 0; i < disks.size(); i++) {
+        diskStates[i].id = disks[i].id;
+        diskStates[i].flags = disks[i].flags;
+        diskStates[i].size = disks[i].size;
+        diskStates[i].label = disks[i].label;
+        diskStates[i].sysPath = disks[i].sysPath;
+    }
+
+    hidl_vec<VolumeState> volumeStates;
+    volumeStates.resize(volumes.size());
+    for (size_t i = 0; i < volumes.size(); i++) {
+        volumeStates[i].id = volumes[i].id;
+        volumeStates[i].type = volumes[i].type;
+        volumeStates[i].diskId = volumes[i].diskId;
+        volumeStates[i].partGuid = volumes[i].partGuid;
+        volumeStates[i].state = volumes[i].state;
+        volumeStates[i].fsType = volumes[i].fsType;
+        volumeStates[i].fsUuid = volumes[i].fsUuid;
+        volumeStates[i].fsLabel = volumes[i].fsLabel;
+        volumeStates[i].path = volumes[i].path;
+        volumeStates[i].internalPath = volumes[i].internalPath;
+    }
+
+    _hidl_cb(seq, diskStates, volumeStates);
+    return Void();
+}
+
+void DroidVold::sendBroadcast(android::droidvold::StorageEvent event) {
+    android::Mutex::Autolock _b(mBroadcastLock);
+    mState.record(event);
+
     if (VolumeManager::Instance()->getDebug())
-        LOG(DEBUG) << "event=" << event << " message=" << message;
+        LOG(DEBUG) << "event=" << event.getCode() << " seq=" << event.getSeq()
+                << " message=" << event.toString();
 
-    hidl_string mss = message;
-    if (mCallback != NULL)
-        mCallback->onEvent(event, mss);
+    mDispatcher->send(event);
+}
 
-    /*
-    for (int i = 0; i < clientSize; i++) {
-        mClients[i]->onEvent(event, mss);
+void DroidVold::deliverBroadcast(
+        const std::vector<android::droidvold::StorageEvent>& events) {
+    std::vector<std::shared_ptr<Client>> clients;
+    {
+        android::Mutex::Autolock _l(mLock);
+        clients = mClients;
     }
-    for (auto client : mClients) {
-        client->onEvent(event, mss);
+
+    for (auto& client : clients) {
+        for (auto& event : events) {
+            // Queued at registration already
+            if (event.getSeq() > client->replayedThrough) {
+                client->queue->send(event);
+            }
+        }
     }
-    */
 }
 
 }  // namespace implementation
@@ -17,13 +17,19 @@
 #ifndef VENDOR_AMLOGIC_HARDWARE_DROIDVOLD_V1_0_DROIDVOLD_H
 #define VENDOR_AMLOGIC_HARDWARE_DROIDVOLD_V1_0_DROIDVOLD_H
 
-#include <vendor/amlogic/hardware/droidvold/1.0/IDroidVold.h>
+#include <vendor/amlogic/droidvold/1.0/IDroidVoldExt.h>
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 
 #include <utils/Mutex.h>
+#include <memory>
 #include <vector>
 
+#include "EventChannel.h"
+#include "EventDispatcher.h"
+#include "JobExecutor.h"
+#include "StorageState.h"
+
 namespace vendor {
 namespace amlogic {
 namespace hardware {
@@ -33,10 +39,14 @@ namespace implementation {
 
 using ::android::hidl::base::V1_0::DebugInfo;
 using ::android::hidl::base::V1_0::IBase;
-using ::vendor::amlogic::hardware::droidvold::V1_0::IDroidVold;
+using ::vendor::amlogic::droidvold::V1_0::DiskState;
+using ::vendor::amlogic::droidvold::V1_0::EventRecord;
+using ::vendor::amlogic::droidvold::V1_0::IDroidVoldExt;
+using ::vendor::amlogic::droidvold::V1_0::VolumeState;
 using ::vendor::amlogic::hardware::droidvold::V1_0::IDroidVoldCallback;
 using ::vendor::amlogic::hardware::droidvold::V1_0::Result;
 using ::android::hardware::hidl_array;
+using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_memory;
 using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
@@ -44,7 +54,7 @@ using ::android::hardware::Return;
 using ::android::hardware::Void;
 using ::android::sp;
 
-class DroidVold : public IDroidVold {
+class DroidVold : public IDroidVoldExt {
 public:
     DroidVold();
     virtual ~DroidVold();
@@ -57,12 +67,73 @@ public:
     Return<Result> unmount(const hidl_string& id) override;
     Return<Result> format(const hidl_string& id, const hidl_string& type) override;
 
+    // Methods from ::android::hidl::base::V1_0::IBase follow.
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& args) override;
+
+    // Methods from ::vendor::amlogic::droidvold::V1_0::IDroidVoldExt follow.
+    Return<uint64_t> mountAsync(const hidl_string& id, uint32_t flag, uint32_t uid) override;
+    Return<uint64_t> unmountAsync(const hidl_string& id) override;
+    Return<uint64_t> formatAsync(const hidl_string& id, const hidl_string& type) override;
+    Return<Result> cancelJob(uint64_t jobId) override;
+    Return<Result> mountAll(const hidl_string& diskId, uint32_t flag, uint32_t uid) override;
+    Return<uint64_t> mountAllAsync(const hidl_string& diskId, uint32_t flag,
+            uint32_t uid) override;
+    Return<uint64_t> addCallback(const sp<IDroidVoldCallback>& callback,
+            uint64_t lastSeq) override;
+    Return<void> removeCallback(uint64_t clientId) override;
+    Return<void> openEventQueue(const sp<IDroidVoldCallback>& callback,
+            openEventQueue_cb _hidl_cb) override;
+    Return<void> getState(getState_cb _hidl_cb) override;
+
+    /* lastSeq for addCallback() that replays nothing */
+    static const uint64_t kNoReplay = UINT64_MAX;
+
     static DroidVold *Instance();
-    void sendBroadcast(int event, const std::string& message);
+    void sendBroadcast(android::droidvold::StorageEvent event);
 
 private:
-    //std::vector<sp<IDroidVoldCallback>> mClients;
-    sp<IDroidVoldCallback> mCallback;
+    struct Client {
+        uint64_t id;
+        sp<IDroidVoldCallback> callback;
+        std::unique_ptr<android::droidvold::EventDispatcher> queue;
+        /* Set once the client opened an event queue, read with atomic_load */
+        std::shared_ptr<android::droidvold::EventChannel> channel;
+        /* Already queued as replay when the client was added */
+        uint64_t replayedThrough;
+        /* Only touched by the client's own queue thread */
+        uint64_t droppedSeen;
+        /* Covered by the last state resent after a drop */
+        uint64_t resyncedThrough;
+    };
+
+    class ClientDeathRecipient : public android::hardware::hidl_death_recipient {
+    public:
+        explicit ClientDeathRecipient(DroidVold* dv) : mDroidVold(dv) {}
+        void serviceDied(uint64_t cookie,
+                const android::wp<::android::hidl::base::V1_0::IBase>& who) override;
+    private:
+        DroidVold* mDroidVold;
+    };
+
+    std::unique_ptr<android::droidvold::JobExecutor> mJobs;
+    std::unique_ptr<android::droidvold::EventDispatcher> mDispatcher;
+    android::droidvold::StorageState mState;
+    /* Keeps sequence numbers in the order events enter mDispatcher */
+    android::Mutex mBroadcastLock;
+
+    /* Runs on the dispatcher thread */
+    void deliverBroadcast(const std::vector<android::droidvold::StorageEvent>& events);
+    /* Runs on the client's queue thread */
+    void deliverToClient(Client* client,
+            const std::vector<android::droidvold::StorageEvent>& events);
+    /* The client registered with callback, or nullptr */
+    std::shared_ptr<Client> findClientLocked(const sp<IDroidVoldCallback>& callback);
+    /* Guarded by mLock */
+    std::vector<std::shared_ptr<Client>> mClients;
+    uint64_t mNextClientId;
+    /* Client registered through setCallback(), 0 if none */
+    uint64_t mFrameworkClientId;
+    sp<ClientDeathRecipient> mDeathRecipient;
     mutable android::Mutex mLock;
 };
 
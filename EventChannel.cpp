@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EventChannel.h"
+
+#include <android-base/logging.h>
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace android {
+namespace droidvold {
+
+using ::vendor::amlogic::droidvold::V1_0::EventArgType;
+using ::vendor::amlogic::droidvold::V1_0::EventRecordFlag;
+
+EventChannel::EventChannel(size_t capacity) :
+        mCapacity(capacity), mEventFlag(nullptr), mWritten(0), mDropped(0), mTruncated(0) {
+    mQueue.reset(new Queue(capacity, true));
+    if (!mQueue->isValid()) {
+        LOG(ERROR) << "Failed to create event queue of " << capacity << " records";
+        return;
+    }
+    if (android::hardware::EventFlag::createEventFlag(mQueue->getEventFlagWord(),
+            &mEventFlag) != OK) {
+        LOG(ERROR) << "Failed to create event queue flag";
+        mEventFlag = nullptr;
+    }
+}
+
+EventChannel::~EventChannel() {
+    if (mEventFlag != nullptr) {
+        android::hardware::EventFlag::deleteEventFlag(&mEventFlag);
+    }
+}
+
+const android::hardware::MQDescriptorSync<EventRecord>* EventChannel::getDesc() {
+    return isValid() ? mQueue->getDesc() : nullptr;
+}
+
+void EventChannel::encode(const StorageEvent& event, nsecs_t timestamp,
+        EventRecord* record) {
+    *record = EventRecord();
+    record->code = event.getCode();
+    record->timestamp = timestamp;
+    record->seq = event.getSeq();
+
+    const std::string& id = event.getId();
+    if (id.size() >= record->id.size()) {
+        record->flags |= EventRecordFlag::TRUNCATED;
+    }
+    strlcpy(reinterpret_cast<char*>(record->id.data()), id.c_str(), record->id.size());
+
+    size_t used = 0;
+    for (auto& arg : event.getArgs()) {
+        if (record->argCount == record->values.size()) {
+            record->flags |= EventRecordFlag::TRUNCATED;
+            break;
+        }
+        size_t i = record->argCount++;
+        switch (arg.type) {
+        case StorageEvent::Arg::Type::kInt:
+            record->argTypes[i] = EventArgType::INT;
+            record->values[i] = arg.value;
+            break;
+        case StorageEvent::Arg::Type::kUnsigned:
+            record->argTypes[i] = EventArgType::UNSIGNED;
+            record->values[i] = arg.value;
+            break;
+        case StorageEvent::Arg::Type::kString:
+        case StorageEvent::Arg::Type::kQuotedString: {
+            record->argTypes[i] = arg.type == StorageEvent::Arg::Type::kString
+                    ? EventArgType::STRING : EventArgType::QUOTED_STRING;
+            // Every string keeps at least its terminator, even if emptied
+            size_t room = record->strings.size() - used;
+            if (room == 0) {
+                record->argCount--;
+                record->flags |= EventRecordFlag::TRUNCATED;
+                return;
+            }
+            size_t len = std::min(arg.text.size(), room - 1);
+            if (len < arg.text.size()) {
+                record->flags |= EventRecordFlag::TRUNCATED;
+            }
+            memcpy(record->strings.data() + used, arg.text.data(), len);
+            used += len + 1;
+            break;
+        }
+        }
+    }
+}
+
+void EventChannel::write(const std::vector<StorageEvent>& events) {
+    if (!isValid() || events.empty()) {
+        return;
+    }
+
+    size_t count = std::min(events.size(), mQueue->availableToWrite());
+    if (count < events.size()) {
+        mDropped += events.size() - count;
+        LOG(WARNING) << "Event queue reader behind, dropped " << events.size() - count
+                << " events";
+    }
+    if (count == 0) {
+        return;
+    }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    mRecords.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        encode(events[i], now, &mRecords[i]);
+        if (mRecords[i].flags & EventRecordFlag::TRUNCATED) {
+            mTruncated++;
+        }
+    }
+
+    if (!mQueue->write(mRecords.data(), count)) {
+        mDropped += count;
+        LOG(WARNING) << "Failed to write " << count << " events to queue";
+        return;
+    }
+    mWritten += count;
+    mEventFlag->wake(kEventsReady);
+}
+
+}  // namespace droidvold
+}  // namespace android
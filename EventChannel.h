@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_EVENT_CHANNEL_H
+#define ANDROID_VOLD_EVENT_CHANNEL_H
+
+#include "StorageEvent.h"
+#include "Utils.h"
+
+#include <fmq/EventFlag.h>
+#include <fmq/MessageQueue.h>
+#include <vendor/amlogic/droidvold/1.0/types.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/* Records of the shared event ring, declared by the droidvold HAL */
+typedef ::vendor::amlogic::droidvold::V1_0::EventRecord EventRecord;
+
+/*
+ * Event transport over a synchronized fast message queue. Each batch is
+ * written to shared memory with one write and the reader is woken once
+ * through the event flag, with no binder transaction per event. When the
+ * reader falls behind, events that don't fit are dropped and counted.
+ */
+class EventChannel {
+public:
+    typedef MessageQueue<EventRecord, android::hardware::kSynchronizedReadWrite> Queue;
+
+    /* Event flag bit set whenever records were written */
+    static const uint32_t kEventsReady = 1 << 0;
+
+    explicit EventChannel(size_t capacity);
+    ~EventChannel();
+
+    bool isValid() { return mEventFlag != nullptr; }
+    const android::hardware::MQDescriptorSync<EventRecord>* getDesc();
+
+    void write(const std::vector<StorageEvent>& events);
+
+    static void encode(const StorageEvent& event, nsecs_t timestamp, EventRecord* record);
+
+    size_t getCapacity() { return mCapacity; }
+    uint64_t getWrittenCount() { return mWritten; }
+    uint64_t getDroppedCount() { return mDropped; }
+    uint64_t getTruncatedCount() { return mTruncated; }
+
+private:
+    size_t mCapacity;
+    std::unique_ptr<Queue> mQueue;
+    android::hardware::EventFlag* mEventFlag;
+    std::vector<EventRecord> mRecords;
+
+    std::atomic<uint64_t> mWritten;
+    std::atomic<uint64_t> mDropped;
+    std::atomic<uint64_t> mTruncated;
+
+    DISALLOW_COPY_AND_ASSIGN(EventChannel);
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
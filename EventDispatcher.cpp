@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EventDispatcher.h"
+
+#include <android-base/logging.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+namespace android {
+namespace droidvold {
+
+/* Pause between retries while a blocking send() waits for room */
+static const useconds_t kBlockRetryUs = 1000;
+/* Most events handed to the sink in one call */
+static const size_t kMaxBatch = 64;
+
+EventDispatcher::EventDispatcher(const Sink& sink, size_t capacity, Overflow overflow) :
+        mSink(sink), mOverflow(overflow), mEnqueuePos(0), mDequeuePos(0), mStopping(false),
+        mMaxDepth(0),
+        mDelivered(0), mDropped(0), mMaxLatency(0), mTotalLatency(0) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mMask = size - 1;
+    mCells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++) {
+        mCells[i].seq = i;
+    }
+    sem_init(&mAvailable, 0, 0);
+}
+
+EventDispatcher::~EventDispatcher() {
+    stop();
+    sem_destroy(&mAvailable);
+}
+
+void EventDispatcher::start() {
+    if (!mThread.joinable()) {
+        mStopping = false;
+        mThread = std::thread(&EventDispatcher::run, this);
+    }
+}
+
+void EventDispatcher::stop() {
+    // Must not be called from the sink, the thread would join itself
+    mStopping = true;
+    sem_post(&mAvailable);
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+EventDispatcher::Overflow EventDispatcher::parseOverflow(const std::string& policy) {
+    if (policy == "block") {
+        return Overflow::kBlock;
+    } else if (policy == "drop_newest") {
+        return Overflow::kDropNewest;
+    }
+    return Overflow::kDropOldest;
+}
+
+// Bounded MPMC ring after Dmitry Vyukov: each cell's sequence number says
+// whether it is free for the producer at pos or filled for the consumer.
+bool EventDispatcher::tryPush(Entry& entry) {
+    Cell* cell;
+    size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        cell = &mCells[pos & mMask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->entry = std::move(entry);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool EventDispatcher::tryPop(Entry& entry) {
+    Cell* cell;
+    size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+        cell = &mCells[pos & mMask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = mDequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    entry = std::move(cell->entry);
+    cell->seq.store(pos + mMask + 1, std::memory_order_release);
+    return true;
+}
+
+void EventDispatcher::send(const StorageEvent& event) {
+    Entry entry = { event, systemTime(SYSTEM_TIME_MONOTONIC) };
+
+    while (!tryPush(entry)) {
+        switch (mOverflow) {
+        case Overflow::kBlock:
+            usleep(kBlockRetryUs);
+            break;
+        case Overflow::kDropOldest: {
+            Entry oldest;
+            if (tryPop(oldest)) {
+                LOG(WARNING) << "Event queue full, dropped " << oldest.event.getCode() << " "
+                        << oldest.event.getId();
+                mDropped++;
+            }
+            break;
+        }
+        case Overflow::kDropNewest:
+            LOG(WARNING) << "Event queue full, dropped " << event.getCode() << " "
+                    << event.getId();
+            mDropped++;
+            return;
+        }
+    }
+
+    size_t depth = getDepth();
+    size_t max = mMaxDepth;
+    while (depth > max && !mMaxDepth.compare_exchange_weak(max, depth)) {
+    }
+    sem_post(&mAvailable);
+}
+
+nsecs_t EventDispatcher::getAverageLatency() {
+    uint64_t delivered = mDelivered;
+    return delivered ? mTotalLatency / (nsecs_t) delivered : 0;
+}
+
+void EventDispatcher::run() {
+    std::vector<Entry> entries;
+    std::vector<StorageEvent> batch;
+    while (true) {
+        if (sem_wait(&mAvailable) && errno == EINTR) {
+            continue;
+        }
+        if (mStopping) {
+            return;
+        }
+
+        Entry entry;
+        bool popped;
+        while (!(popped = tryPop(entry))) {
+            // Dropped by an overflowing producer, or taken by an earlier batch
+            if (mDequeuePos == mEnqueuePos) {
+                break;
+            }
+            // A producer has claimed the slot but not filled it yet
+            std::this_thread::yield();
+        }
+        if (!popped) {
+            continue;
+        }
+
+        // Take along whatever else is ready; their semaphore counts are
+        // consumed by later wakeups that find the ring empty
+        entries.push_back(std::move(entry));
+        while (entries.size() < kMaxBatch && tryPop(entry)) {
+            entries.push_back(std::move(entry));
+        }
+
+        for (auto& e : entries) {
+            batch.push_back(std::move(e.event));
+        }
+        mSink(batch);
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (auto& e : entries) {
+            nsecs_t latency = now - e.queued;
+            mTotalLatency += latency;
+            nsecs_t max = mMaxLatency;
+            while (latency > max && !mMaxLatency.compare_exchange_weak(max, latency)) {
+            }
+        }
+        mDelivered += entries.size();
+        entries.clear();
+        batch.clear();
+    }
+}
+
+}  // namespace droidvold
+}  // namespace android
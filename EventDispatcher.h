@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_EVENT_DISPATCHER_H
+#define ANDROID_VOLD_EVENT_DISPATCHER_H
+
+#include "StorageEvent.h"
+#include "Utils.h"
+
+#include <utils/Timers.h>
+
+#include <semaphore.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Decouples broadcasters from the client callback. send() puts the event
+ * into a bounded lock-free ring and returns; a dedicated thread delivers
+ * events to the sink in order. A slow or wedged client then only backs up
+ * the ring instead of the threads handling storage.
+ *
+ * Whatever has queued up while the sink was busy is handed over as one
+ * batch, so a disk bring-up can reach a client in a single call.
+ */
+class EventDispatcher {
+public:
+    typedef std::function<void(const std::vector<StorageEvent>&)> Sink;
+
+    /* What send() does when the ring is full */
+    enum class Overflow {
+        /* Wait for the dispatcher to make room */
+        kBlock,
+        /* Discard the oldest queued event */
+        kDropOldest,
+        /* Discard the event being sent */
+        kDropNewest,
+    };
+
+    /* capacity is rounded up to a power of two */
+    EventDispatcher(const Sink& sink, size_t capacity, Overflow overflow);
+    ~EventDispatcher();
+
+    void start();
+    /* Stops delivery, dropping whatever is still queued */
+    void stop();
+    void send(const StorageEvent& event);
+
+    static Overflow parseOverflow(const std::string& policy);
+
+    size_t getCapacity() { return mMask + 1; }
+    size_t getDepth() { return mEnqueuePos - mDequeuePos; }
+    size_t getMaxDepth() { return mMaxDepth; }
+    uint64_t getDeliveredCount() { return mDelivered; }
+    uint64_t getDroppedCount() { return mDropped; }
+    /* From send() until the sink returned */
+    nsecs_t getMaxLatency() { return mMaxLatency; }
+    nsecs_t getAverageLatency();
+
+private:
+    struct Entry {
+        StorageEvent event;
+        nsecs_t queued;
+    };
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        Entry entry;
+    };
+
+    Sink mSink;
+    Overflow mOverflow;
+
+    std::unique_ptr<Cell[]> mCells;
+    size_t mMask;
+    std::atomic<size_t> mEnqueuePos;
+    std::atomic<size_t> mDequeuePos;
+    /* Counts published events, the dispatcher sleeps on it */
+    sem_t mAvailable;
+    std::atomic<bool> mStopping;
+    std::thread mThread;
+
+    std::atomic<size_t> mMaxDepth;
+    std::atomic<uint64_t> mDelivered;
+    std::atomic<uint64_t> mDropped;
+    std::atomic<nsecs_t> mMaxLatency;
+    std::atomic<nsecs_t> mTotalLatency;
+
+    bool tryPush(Entry& entry);
+    bool tryPop(Entry& entry);
+    void run();
+
+    DISALLOW_COPY_AND_ASSIGN(EventDispatcher);
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
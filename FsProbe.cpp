@@ -0,0 +1,730 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FsProbe.h"
+#include "Checksum.h"
+#include "Utils.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace droidvold {
+
+/* Every superblock and the start of the UDF recognition sequence */
+static const size_t kProbeSize = 128 * 1024;
+static const size_t kProbeAlignment = 4096;
+/* Bounds the reads made while chasing labels */
+static const size_t kMaxChunk = 64 * 1024;
+
+namespace {
+
+uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+uint32_t le32(const uint8_t* p) { return le16(p) | ((uint32_t) le16(p + 2) << 16); }
+uint64_t le64(const uint8_t* p) { return le32(p) | ((uint64_t) le32(p + 4) << 32); }
+uint16_t be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+uint32_t be32(const uint8_t* p) { return ((uint32_t) be16(p) << 16) | be16(p + 2); }
+
+struct Result {
+    std::string type;
+    std::string uuid;
+    std::string label;
+};
+
+/*
+ * The head of the device, read once, plus on-demand reads further in.
+ * A pointer from read() stays valid until the next read() beyond the head.
+ */
+class Device {
+public:
+    explicit Device(int fd) : mFd(fd), mHead(nullptr), mHeadLen(0) {}
+    ~Device() { free(mHead); }
+
+    status_t load() {
+        if (posix_memalign((void**) &mHead, kProbeAlignment, kProbeSize)) {
+            mHead = nullptr;
+            return -ENOMEM;
+        }
+        while (mHeadLen < kProbeSize) {
+            ssize_t n = TEMP_FAILURE_RETRY(pread(mFd, mHead + mHeadLen,
+                    kProbeSize - mHeadLen, mHeadLen));
+            if (n < 0) {
+                return -errno;
+            } else if (n == 0) {
+                break;
+            }
+            mHeadLen += n;
+        }
+        return OK;
+    }
+
+    const uint8_t* read(uint64_t off, size_t len) {
+        if (off + len <= mHeadLen) {
+            return mHead + off;
+        }
+        mExtra.resize(len);
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = TEMP_FAILURE_RETRY(pread(mFd, mExtra.data() + done, len - done,
+                    off + done));
+            if (n <= 0) {
+                return nullptr;
+            }
+            done += n;
+        }
+        return mExtra.data();
+    }
+
+private:
+    int mFd;
+    uint8_t* mHead;
+    size_t mHeadLen;
+    std::vector<uint8_t> mExtra;
+
+    DISALLOW_COPY_AND_ASSIGN(Device);
+};
+
+/* Drops trailing blanks and NULs like blkid's figure_label_len() */
+std::string trimLabel(const uint8_t* label, size_t len) {
+    while (len > 0 && (label[len - 1] == ' ' || label[len - 1] == 0)) {
+        len--;
+    }
+    return std::string((const char*) label, strnlen((const char*) label, len));
+}
+
+/* Canonical lowercase form, or empty when the UUID is all zeroes */
+std::string formatUuid(const uint8_t* u) {
+    static const uint8_t kZero[16] = {};
+    if (!memcmp(u, kZero, sizeof(kZero))) {
+        return "";
+    }
+    return StringPrintf("%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+            "%02x%02x%02x%02x%02x%02x", u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7],
+            u[8], u[9], u[10], u[11], u[12], u[13], u[14], u[15]);
+}
+
+/* Volume serials print as in DOS, most significant byte first */
+std::string formatSerial(const uint8_t* s) {
+    return StringPrintf("%02X%02X-%02X%02X", s[3], s[2], s[1], s[0]);
+}
+
+/* BMP only and stops at the first NUL, as blkid's converters do */
+std::string utf16ToUtf8(const uint8_t* s, size_t len, bool bigEndian, size_t maxOut) {
+    std::string out;
+    for (size_t i = 0; i + 2 <= len; i += 2) {
+        unsigned c = bigEndian ? be16(s + i) : le16(s + i);
+        if (c == 0) {
+            break;
+        } else if (c < 0x80) {
+            if (out.size() + 1 >= maxOut) break;
+            out += (char) c;
+        } else if (c < 0x800) {
+            if (out.size() + 2 >= maxOut) break;
+            out += (char) (0xc0 | (c >> 6));
+            out += (char) (0x80 | (c & 0x3f));
+        } else {
+            if (out.size() + 3 >= maxOut) break;
+            out += (char) (0xe0 | (c >> 12));
+            out += (char) (0x80 | ((c >> 6) & 0x3f));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+    }
+    return out;
+}
+
+/*
+ * ext2/3/4: the type follows from the feature bits the older drivers
+ * would refuse.
+ */
+static const uint32_t kExtCompatHasJournal = 0x0004;
+static const uint32_t kExtIncompatJournalDev = 0x0008;
+static const uint32_t kExt2IncompatSupp = 0x0012;
+static const uint32_t kExt3IncompatSupp = 0x0016;
+static const uint32_t kExt3RoCompatSupp = 0x0007;
+static const uint32_t kExtRoCompatMetadataCsum = 0x0400;
+static const size_t kExtChecksumOffset = 0x3FC;
+
+bool probeExt(Device& dev, Result& r) {
+    const uint8_t* sb = dev.read(1024, 1024);
+    if (!sb || le16(sb + 0x38) != 0xEF53) {
+        return false;
+    }
+
+    uint32_t compat = le32(sb + 0x5C);
+    uint32_t incompat = le32(sb + 0x60);
+    uint32_t roCompat = le32(sb + 0x64);
+    if (incompat & kExtIncompatJournalDev) {
+        // External journal, not a filesystem
+        return false;
+    }
+
+    if ((roCompat & ~kExt3RoCompatSupp) || (incompat & ~kExt3IncompatSupp)) {
+        r.type = "ext4";
+    } else if (compat & kExtCompatHasJournal) {
+        r.type = "ext3";
+    } else if (!(incompat & ~kExt2IncompatSupp)) {
+        r.type = "ext2";
+    } else {
+        return false;
+    }
+    // Like blkid, still report it; mounting will refuse or fsck repair it
+    if ((roCompat & kExtRoCompatMetadataCsum)
+            && Crc32c(~0u, sb, kExtChecksumOffset) != le32(sb + kExtChecksumOffset)) {
+        LOG(WARNING) << "ext4 superblock checksum mismatch";
+    }
+
+    r.uuid = formatUuid(sb + 0x68);
+    r.label = std::string((const char*) sb + 0x78, strnlen((const char*) sb + 0x78, 16));
+    return true;
+}
+
+/* NTFS: serial from the boot sector, label from the $Volume MFT record */
+static const uint32_t kNtfsAttrVolumeName = 0x60;
+static const uint32_t kNtfsAttrEnd = 0xFFFFFFFF;
+static const uint64_t kNtfsMftRecordVolume = 3;
+
+bool probeNtfs(Device& dev, const uint8_t* boot, Result& r) {
+    if (memcmp(boot + 3, "NTFS    ", 8)) {
+        return false;
+    }
+
+    uint32_t sectorSize = le16(boot + 11);
+    uint32_t sectorsPerCluster = boot[13];
+    if (sectorSize < 512 || sectorsPerCluster == 0) {
+        return false;
+    }
+    uint64_t clusterSize = sectorSize * sectorsPerCluster;
+    int8_t perRecord = (int8_t) boot[64];
+    uint64_t recordSize = perRecord < 0 ? 1ULL << std::min(-perRecord, 31)
+            : perRecord * clusterSize;
+    if (recordSize < 64 || recordSize > kMaxChunk) {
+        return false;
+    }
+
+    uint64_t clusters = le64(boot + 40) / sectorsPerCluster;
+    uint64_t mft = le64(boot + 48);
+    uint64_t mftMirror = le64(boot + 56);
+    if (mft > clusters || mftMirror > clusters) {
+        return false;
+    }
+
+    const uint8_t* rec = dev.read(mftMirror * clusterSize, recordSize);
+    if (!rec || memcmp(rec, "FILE", 4)) {
+        return false;
+    }
+    rec = dev.read(mft * clusterSize, recordSize);
+    if (!rec || memcmp(rec, "FILE", 4)) {
+        return false;
+    }
+    rec = dev.read(mft * clusterSize + kNtfsMftRecordVolume * recordSize, recordSize);
+    if (!rec || memcmp(rec, "FILE", 4)) {
+        return false;
+    }
+    // The label may cross a block end, where the fixups put the real bytes
+    std::vector<uint8_t> volume(rec, rec + recordSize);
+    if (ApplyNtfsFixups(volume.data(), volume.size())) {
+        rec = volume.data();
+    }
+
+    std::string label;
+    uint64_t attrOff = le16(rec + 20);
+    while (attrOff + 24 <= recordSize) {
+        const uint8_t* attr = rec + attrOff;
+        uint32_t type = le32(attr);
+        uint32_t len = le32(attr + 4);
+        if (type == kNtfsAttrEnd || len == 0 || attrOff + len > recordSize) {
+            break;
+        }
+        if (type == kNtfsAttrVolumeName) {
+            uint32_t valLen = std::min(le32(attr + 16), (uint32_t) 128);
+            uint32_t valOff = le16(attr + 20);
+            if (valOff + valLen <= len) {
+                // Non-Latin-1 characters come out as '?', like blkid
+                label.clear();
+                for (uint32_t i = 0; i + 1 < valLen; i += 2) {
+                    const uint8_t* c = attr + valOff + i;
+                    label += c[1] ? '?' : (char) c[0];
+                }
+            }
+        }
+        attrOff += len;
+    }
+
+    r.type = "ntfs";
+    r.uuid = StringPrintf("%016" PRIX64, le64(boot + 0x48));
+    r.label = label;
+    return true;
+}
+
+/* FAT12/16/32 */
+static const uint32_t kFat32Max = 0x0ffffff6;
+static const int kFatMaxRootClusters = 100;
+static const uint8_t kFatNoName[] = "NO NAME    ";
+
+bool isFatMagic(const uint8_t* b) {
+    return !memcmp(b + 0x52, "MSWIN", 5) || !memcmp(b + 0x52, "FAT32   ", 8)
+            || !memcmp(b + 0x36, "MSDOS", 5) || !memcmp(b + 0x36, "FAT16   ", 8)
+            || !memcmp(b + 0x36, "FAT12   ", 8) || !memcmp(b + 0x36, "FAT     ", 8);
+}
+
+/* Boot sectors without an FS type string, checked the way blkid does */
+bool isFatNoMagic(const uint8_t* b) {
+    if (b[0] != 0xEB && b[0] != 0xE9 && (b[0x1fe] != 0x55 || b[0x1ff] != 0xAA)) {
+        return false;
+    }
+    uint8_t clusterSize = b[13];
+    uint8_t media = b[21];
+    return le16(b + 26) != 0
+            && clusterSize != 0 && !(clusterSize & (clusterSize - 1))
+            && (media >= 0xf8 || media == 0xf0)
+            && b[16] != 0
+            && memcmp(b + 0x36, "JFS     ", 8) && memcmp(b + 0x36, "HPFS    ", 8);
+}
+
+/* Volume label entry of a directory, copied into label */
+bool findFatLabel(const uint8_t* dir, size_t count, uint8_t* label) {
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* entry = dir + i * 32;
+        uint8_t attr = entry[11];
+        if (entry[0] == 0x00) {
+            break;
+        }
+        if (entry[0] == 0xe5 || le16(entry + 20) != 0 || le16(entry + 26) != 0
+                || (attr & 0x3f) == 0x0f) {
+            continue;
+        }
+        if ((attr & 0x18) == 0x08) {
+            memcpy(label, entry, 11);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool probeFat(Device& dev, const uint8_t* boot, Result& r) {
+    uint32_t sectorSize = le16(boot + 11);
+    if (sectorSize != 0x200 && sectorSize != 0x400 && sectorSize != 0x800
+            && sectorSize != 0x1000) {
+        return false;
+    }
+
+    uint32_t clusterSize = boot[13];
+    uint32_t dirEntries = le16(boot + 17);
+    uint32_t reserved = le16(boot + 14);
+    uint32_t sectors = le16(boot + 19);
+    if (sectors == 0) {
+        sectors = le32(boot + 32);
+    }
+    uint32_t fatLength = le16(boot + 22);
+    bool fat32 = fatLength == 0;
+    if (fat32) {
+        fatLength = le32(boot + 36);
+    }
+    uint32_t fatSize = fatLength * boot[16];
+    uint32_t dirSize = (dirEntries * 32 + sectorSize - 1) / sectorSize;
+    if (clusterSize == 0) {
+        return false;
+    }
+    uint32_t clusters = (sectors - (reserved + fatSize + dirSize)) / clusterSize;
+    if (clusters > kFat32Max) {
+        return false;
+    }
+
+    uint8_t label[11];
+    bool found = false;
+    const uint8_t* serial;
+    if (!fat32) {
+        const uint8_t* dir = dev.read((uint64_t) (reserved + fatSize) * sectorSize,
+                dirEntries * 32);
+        found = dir && findFatLabel(dir, dirEntries, label);
+        if (!found || !memcmp(label, kFatNoName, 11)) {
+            memcpy(label, boot + 43, 11);
+        }
+        serial = boot + 39;
+    } else {
+        uint64_t dataStart = reserved + fatSize;
+        uint64_t bytesPerCluster = clusterSize * sectorSize;
+        uint32_t next = le32(boot + 44);
+        for (int loop = 1; next && loop < kFatMaxRootClusters && !found; loop++) {
+            const uint8_t* dir = dev.read(
+                    (dataStart + (uint64_t) (next - 2) * clusterSize) * sectorSize,
+                    bytesPerCluster);
+            if (!dir) {
+                break;
+            }
+            found = findFatLabel(dir, bytesPerCluster / 32, label);
+            if (!found) {
+                const uint8_t* entry = dev.read((uint64_t) reserved * sectorSize
+                        + next * 4ULL, 4);
+                if (!entry) {
+                    break;
+                }
+                next = le32(entry) & 0x0fffffff;
+            }
+        }
+        if (!found || !memcmp(label, kFatNoName, 11)) {
+            memcpy(label, boot + 71, 11);
+        }
+        serial = boot + 67;
+    }
+
+    r.type = "vfat";
+    r.uuid = formatSerial(serial);
+    r.label = memcmp(label, kFatNoName, 11) ? trimLabel(label, 11) : "";
+    return true;
+}
+
+/* exFAT: label from the root directory, "disk" when it has none */
+static const size_t kExfatMaxEntries = 10000;
+static const uint8_t kExfatEntryEod = 0x00;
+static const uint8_t kExfatEntryLabel = 0x83;
+
+bool probeExfat(Device& dev, const uint8_t* boot, Result& r) {
+    if (memcmp(boot + 3, "EXFAT   ", 8)) {
+        return false;
+    }
+    uint32_t blockBits = boot[108];
+    uint32_t clusterBits = boot[109];
+    if (blockBits < 9 || blockBits > 12 || clusterBits > 25) {
+        return false;
+    }
+
+    // Sectors 0-10 of the boot region, then one full of the checksum
+    size_t sectorSize = 1 << blockBits;
+    const uint8_t* region = dev.read(0, 12 * sectorSize);
+    if (region && ExfatBootChecksum(region, sectorSize) != le32(region + 11 * sectorSize)) {
+        LOG(WARNING) << "exFAT boot region checksum mismatch";
+    }
+
+    uint64_t clusterSize = 1ULL << (blockBits + clusterBits);
+    uint64_t fatStart = (uint64_t) le32(boot + 80) << blockBits;
+    uint64_t heapStart = (uint64_t) le32(boot + 88) << blockBits;
+    auto clusterOffset = [&](uint32_t cluster) {
+        return heapStart + ((uint64_t) (cluster - 2) << (blockBits + clusterBits));
+    };
+
+    std::string label = "disk";
+    uint32_t cluster = le32(boot + 96);
+    uint64_t off = clusterOffset(cluster);
+    size_t chunk = std::min(clusterSize, (uint64_t) kMaxChunk);
+    const uint8_t* buf = nullptr;
+    size_t pos = chunk;
+    for (size_t i = 0; i < kExfatMaxEntries; i++) {
+        if (pos == chunk) {
+            buf = dev.read(off, chunk);
+            if (!buf) {
+                break;
+            }
+            pos = 0;
+        }
+        const uint8_t* entry = buf + pos;
+        if (entry[0] == kExfatEntryEod) {
+            break;
+        }
+        if (entry[0] == kExfatEntryLabel) {
+            label = utf16ToUtf8(entry + 2, std::min(entry[1], (uint8_t) 15) * 2, false, 128);
+            break;
+        }
+
+        pos += 32;
+        off += 32;
+        if ((off - heapStart) % clusterSize == 0) {
+            const uint8_t* next = dev.read(fatStart + cluster * 4ULL, 4);
+            cluster = next ? le32(next) : 0;
+            if (cluster < 2 || cluster > 0xFFFFFFF6) {
+                break;
+            }
+            off = clusterOffset(cluster);
+            pos = chunk;
+        }
+    }
+
+    r.type = "exfat";
+    r.uuid = formatSerial(boot + 100);
+    r.label = label;
+    return true;
+}
+
+/* UDF: some NSR descriptor in the volume recognition sequence */
+bool probeUdf(Device& dev, Result& r) {
+    const uint8_t* vsd = dev.read(32768, 8);
+    if (!vsd) {
+        return false;
+    }
+    static const char* const kMagics[] = {
+        "BEA01", "BOOT2", "CD001", "CDW02", "NSR02", "NSR03", "TEA01",
+    };
+    bool magic = false;
+    for (auto m : kMagics) {
+        magic |= !memcmp(vsd + 1, m, 5);
+    }
+    if (!magic) {
+        return false;
+    }
+
+    // Descriptors sit on block boundaries, larger blocks are zero padded
+    int bs;
+    for (bs = 1; bs < 16; bs++) {
+        vsd = dev.read(bs * 2048 + 32768, 8);
+        if (!vsd) {
+            return false;
+        }
+        if (vsd[1]) {
+            break;
+        }
+    }
+    for (int j = 1; j < 64; j++) {
+        vsd = dev.read((uint64_t) j * bs * 2048 + 32768, 8);
+        if (!vsd) {
+            return false;
+        }
+        if (!memcmp(vsd + 1, "NSR0", 4)) {
+            r.type = "udf";
+            return true;
+        }
+    }
+    return false;
+}
+
+bool probeIso9660(Device& dev, Result& r) {
+    const uint8_t* pvd = dev.read(32768, 2048);
+    if (!pvd || memcmp(pvd + 1, "CD001", 5)) {
+        return false;
+    }
+    r.type = "iso9660";
+    r.label = trimLabel(pvd + 40, 32);
+    return true;
+}
+
+/* HFS+, possibly wrapped in an HFS volume; label from the catalog B-tree */
+bool probeHfsPlus(Device& dev, Result& r) {
+    const uint8_t* vh = dev.read(1024, 512);
+    if (!vh) {
+        return false;
+    }
+
+    uint64_t off = 0;
+    if (!memcmp(vh, "BD", 2)) {
+        if (memcmp(vh + 0x7C, "H+", 2) && memcmp(vh + 0x7C, "HX", 2)) {
+            return false;
+        }
+        uint32_t allocBlockSize = be32(vh + 0x14);
+        uint32_t allocFirstBlock = be16(vh + 0x1C);
+        uint32_t embedFirstBlock = be16(vh + 0x7E);
+        off = (uint64_t) allocFirstBlock * 512 + (uint64_t) embedFirstBlock * allocBlockSize;
+        vh = dev.read(off + 1024, 512);
+        if (!vh || (memcmp(vh, "H+", 2) && memcmp(vh, "HX", 2))) {
+            return false;
+        }
+    } else if (memcmp(vh, "H+", 2) && memcmp(vh, "HX", 2)) {
+        return false;
+    }
+
+    r.type = "hfsplus";
+    uint64_t id = le64(vh + 0x68);
+    if (id) {
+        r.uuid = StringPrintf("%016" PRIX64, id);
+    }
+
+    uint32_t blockSize = be32(vh + 40);
+    uint32_t extents[8][2];
+    for (int i = 0; i < 8; i++) {
+        extents[i][0] = be32(vh + 288 + i * 8);
+        extents[i][1] = be32(vh + 292 + i * 8);
+    }
+    if (blockSize == 0) {
+        return true;
+    }
+
+    const uint8_t* header = dev.read(off + (uint64_t) extents[0][0] * blockSize, 512);
+    if (!header) {
+        return true;
+    }
+    uint32_t leafHead = be32(header + 24);
+    uint32_t nodeSize = be16(header + 32);
+    uint32_t leafCount = be32(header + 20);
+    if (leafCount == 0 || nodeSize < 22) {
+        return true;
+    }
+
+    // Find the extent holding the first leaf node
+    uint32_t leafBlock = (leafHead * nodeSize) / blockSize;
+    int ext;
+    for (ext = 0; ext < 8; ext++) {
+        if (extents[ext][1] == 0) {
+            return true;
+        }
+        if (leafBlock < extents[ext][1]) {
+            break;
+        }
+        leafBlock -= extents[ext][1];
+    }
+    if (ext == 8) {
+        return true;
+    }
+
+    const uint8_t* node = dev.read(off + (uint64_t) (extents[ext][0] + leafBlock) * blockSize,
+            nodeSize);
+    // The first leaf record is the root folder's thread, keyed by the volume name
+    if (!node || node[8] != 0xff || be32(node + 16) != 1) {
+        return true;
+    }
+    size_t labelLen = std::min((size_t) be16(node + 20) * 2, (size_t) nodeSize - 22);
+    r.label = utf16ToUtf8(node + 22, labelLen, true, 256);
+    return true;
+}
+
+bool probeHfs(Device& dev, Result& r) {
+    const uint8_t* mdb = dev.read(1024, 512);
+    if (!mdb || memcmp(mdb, "BD", 2)) {
+        return false;
+    }
+    // Wrapper around HFS+ that probeHfsPlus() couldn't read
+    if (!memcmp(mdb + 0x7C, "H+", 2) || !memcmp(mdb + 0x7C, "HX", 2)) {
+        return false;
+    }
+    r.type = "hfs";
+    uint64_t id = le64(mdb + 116);
+    if (id) {
+        r.uuid = StringPrintf("%016" PRIX64, id);
+    }
+    r.label = std::string((const char*) mdb + 37, std::min(mdb[36], (uint8_t) 27));
+    return true;
+}
+
+bool probeF2fs(Device& dev, Result& r) {
+    const uint8_t* sb = dev.read(1024, 1024);
+    if (!sb || le32(sb) != 0xF2F52010) {
+        return false;
+    }
+    r.type = "f2fs";
+    r.uuid = formatUuid(sb + 108);
+    return true;
+}
+
+}  // namespace
+
+status_t ProbeFilesystem(const std::string& path, std::string& fsType,
+        std::string& fsUuid, std::string& fsLabel) {
+    int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        // A missing node must not read as a device without a filesystem
+        status_t res = errno == ENOENT ? -ENODEV : -errno;
+        PLOG(WARNING) << "Failed to open " << path << " for probing";
+        return res;
+    }
+
+    Device dev(fd);
+    status_t res = dev.load();
+    Result r;
+    bool found = false;
+    const uint8_t* boot = res == OK ? dev.read(0, 512) : nullptr;
+    if (boot) {
+        // Same order as the libext2_blkid magic table
+        found = probeNtfs(dev, boot, r)
+                || probeExt(dev, r)
+                || (isFatMagic(boot) && probeFat(dev, boot, r))
+                || (isFatNoMagic(boot) && probeFat(dev, boot, r))
+                || probeUdf(dev, r)
+                || probeIso9660(dev, r)
+                || probeHfsPlus(dev, r)
+                || probeHfs(dev, r)
+                || probeF2fs(dev, r)
+                || probeExfat(dev, boot, r);
+    }
+    close(fd);
+
+    if (res != OK) {
+        LOG(WARNING) << "Failed to read " << path << " for probing: " << strerror(-res);
+        return res;
+    }
+    if (!found) {
+        return -ENOENT;
+    }
+
+    fsType = r.type;
+    fsUuid = r.uuid;
+    fsLabel = r.label;
+    return OK;
+}
+
+ProbeCache* ProbeCache::Instance() {
+    static ProbeCache* sInstance = new ProbeCache();
+    return sInstance;
+}
+
+bool ProbeCache::lookup(dev_t device, uint64_t generation, std::string& fsType,
+        std::string& fsUuid, std::string& fsLabel) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mEntries.find(device);
+    if (it == mEntries.end() || it->second.generation != generation) {
+        mMisses++;
+        return false;
+    }
+    mHits++;
+    fsType = it->second.fsType;
+    fsUuid = it->second.fsUuid;
+    fsLabel = it->second.fsLabel;
+    return true;
+}
+
+void ProbeCache::insert(dev_t device, dev_t disk, uint64_t generation, uint64_t epoch,
+        const std::string& fsType, const std::string& fsUuid, const std::string& fsLabel) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (epoch != mEpoch) {
+        return;
+    }
+    mEntries[device] = Entry{disk, generation, fsType, fsUuid, fsLabel};
+}
+
+void ProbeCache::invalidate(dev_t device) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mEpoch++;
+    mEntries.erase(device);
+}
+
+void ProbeCache::invalidateDisk(dev_t disk) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mEpoch++;
+    for (auto it = mEntries.begin(); it != mEntries.end();) {
+        if (it->first == disk || it->second.disk == disk) {
+            it = mEntries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+size_t ProbeCache::size() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mEntries.size();
+}
+
+}  // namespace droidvold
+}  // namespace android
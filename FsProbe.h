@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_FS_PROBE_H
+#define ANDROID_VOLD_FS_PROBE_H
+
+#include <utils/Errors.h>
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Identifies the filesystem on an untrusted block device from its
+ * superblocks, without libblkid's prober chain. The start of the device
+ * is read with one large aligned pread; only label lookups that live
+ * further in (FAT and exFAT root directories, the NTFS $Volume record,
+ * the HFS+ catalog) cost an extra read.
+ *
+ * Detects vfat, exfat, ntfs, ext2/3/4, hfsplus, hfs, iso9660, udf and
+ * f2fs, and reports TYPE, UUID and LABEL exactly as the libext2_blkid
+ * probes do, so volume UUIDs and mount paths don't change.
+ *
+ * Returns -ENOENT only if the device was read and no known filesystem
+ * was found on it.
+ */
+status_t ProbeFilesystem(const std::string& path, std::string& fsType,
+        std::string& fsUuid, std::string& fsLabel);
+
+/*
+ * Remembers what was found on each block device, keyed by its device
+ * number and the media generation of its disk, so probing an unchanged
+ * volume again costs a hash lookup instead of device reads. Change and
+ * remove uevents drop the entries of the media they touch; a stale
+ * generation never matches either.
+ */
+class ProbeCache {
+public:
+    static ProbeCache* Instance();
+
+    /* False on a miss; outputs are only assigned on a hit */
+    bool lookup(dev_t device, uint64_t generation, std::string& fsType,
+            std::string& fsUuid, std::string& fsLabel);
+    /*
+     * Taken before probing and passed to insert(), which then drops the
+     * result if an invalidation raced with the probe.
+     */
+    uint64_t getEpoch() { return mEpoch; }
+    /* An empty fsType records that nothing was found */
+    void insert(dev_t device, dev_t disk, uint64_t generation, uint64_t epoch,
+            const std::string& fsType, const std::string& fsUuid, const std::string& fsLabel);
+    void invalidate(dev_t device);
+    /* Drops the disk itself and every partition probed on it */
+    void invalidateDisk(dev_t disk);
+
+    size_t size();
+    uint64_t getHits() { return mHits; }
+    uint64_t getMisses() { return mMisses; }
+
+private:
+    ProbeCache() : mEpoch(0), mHits(0), mMisses(0) {}
+
+    struct Entry {
+        dev_t disk;
+        uint64_t generation;
+        std::string fsType;
+        std::string fsUuid;
+        std::string fsLabel;
+    };
+
+    std::mutex mLock;
+    std::unordered_map<dev_t, Entry> mEntries;
+    /* Bumped under mLock by every invalidation */
+    std::atomic<uint64_t> mEpoch;
+    std::atomic<uint64_t> mHits;
+    std::atomic<uint64_t> mMisses;
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
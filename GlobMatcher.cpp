@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "GlobMatcher.h"
+
+#include <android-base/logging.h>
+
+#include <algorithm>
+
+namespace android {
+namespace droidvold {
+
+// Parses a bracket expression starting after '['. Returns the index just
+// past the closing ']', or 0 when the bracket is unterminated and '['
+// should be taken literally, as fnmatch does.
+static size_t parseClass(const std::string& pattern, size_t i, std::bitset<256>& set) {
+    bool negate = false;
+    if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^')) {
+        negate = true;
+        i++;
+    }
+
+    bool first = true;
+    while (i < pattern.size()) {
+        unsigned char c = pattern[i];
+        if (c == ']' && !first) {
+            if (negate) {
+                set.flip();
+            }
+            return i + 1;
+        }
+        first = false;
+
+        if (c == '\\' && i + 1 < pattern.size()) {
+            c = pattern[++i];
+        }
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+            i += 2;
+            if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+                i++;
+            }
+            unsigned char end = pattern[i];
+            for (unsigned int ch = c; ch <= end; ch++) {
+                set.set(ch);
+            }
+            i++;
+        } else {
+            set.set(c);
+            i++;
+        }
+    }
+    return 0;
+}
+
+int GlobMatcher::add(const std::string& pattern) {
+    int index = mPatterns++;
+
+    size_t i = 0;
+    while (i < pattern.size()) {
+        char c = pattern[i];
+        State state = { Kind::kLiteral, c, 0 };
+        if (c == '*') {
+            state.kind = Kind::kStar;
+            // Consecutive stars are the same as one
+            while (i < pattern.size() && pattern[i] == '*') {
+                i++;
+            }
+            mStates.push_back(state);
+            continue;
+        } else if (c == '?') {
+            state.kind = Kind::kAny;
+        } else if (c == '[') {
+            std::bitset<256> set;
+            size_t end = parseClass(pattern, i + 1, set);
+            if (end) {
+                state.kind = Kind::kClass;
+                state.arg = mClasses.size();
+                mClasses.push_back(set);
+                mStates.push_back(state);
+                i = end;
+                continue;
+            }
+        } else if (c == '\\' && i + 1 < pattern.size()) {
+            state.literal = pattern[++i];
+        }
+        mStates.push_back(state);
+        i++;
+    }
+
+    State accept = { Kind::kAccept, 0, index };
+    mStates.push_back(accept);
+
+    // The DFA is stale until the next compile()
+    mTransitions.clear();
+    mAccept.clear();
+    return index;
+}
+
+void GlobMatcher::enter(StateSet& set, size_t state) const {
+    // A star may match nothing, so entering it also enters what follows
+    while (true) {
+        set[state / 64] |= 1ULL << (state % 64);
+        if (mStates[state].kind != Kind::kStar) {
+            break;
+        }
+        state++;
+    }
+}
+
+GlobMatcher::StateSet GlobMatcher::initial() const {
+    StateSet set((mStates.size() + 63) / 64, 0);
+
+    // Every pattern starts right after the previous one's accept state
+    size_t start = 0;
+    for (size_t s = 0; s < mStates.size(); s++) {
+        if (s == start) {
+            enter(set, s);
+        }
+        if (mStates[s].kind == Kind::kAccept) {
+            start = s + 1;
+        }
+    }
+    return set;
+}
+
+bool GlobMatcher::step(const StateSet& current, unsigned char c, StateSet& next) const {
+    bool alive = false;
+    std::fill(next.begin(), next.end(), 0);
+
+    for (size_t w = 0; w < current.size(); w++) {
+        uint64_t bits = current[w];
+        while (bits) {
+            size_t s = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            const State& state = mStates[s];
+            switch (state.kind) {
+            case Kind::kLiteral:
+                if ((unsigned char) state.literal == c) {
+                    enter(next, s + 1);
+                    alive = true;
+                }
+                break;
+            case Kind::kAny:
+                enter(next, s + 1);
+                alive = true;
+                break;
+            case Kind::kClass:
+                if (mClasses[state.arg].test(c)) {
+                    enter(next, s + 1);
+                    alive = true;
+                }
+                break;
+            case Kind::kStar:
+                enter(next, s);
+                alive = true;
+                break;
+            case Kind::kAccept:
+                break;
+            }
+        }
+    }
+    return alive;
+}
+
+int GlobMatcher::accepting(const StateSet& set) const {
+    // States are laid out in pattern order, so the first accept wins
+    for (size_t w = 0; w < set.size(); w++) {
+        uint64_t bits = set[w];
+        while (bits) {
+            size_t s = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (mStates[s].kind == Kind::kAccept) {
+                return mStates[s].arg;
+            }
+        }
+    }
+    return -1;
+}
+
+void GlobMatcher::buildByteClasses() {
+    // Two bytes are equivalent when every literal and bracket agrees on them
+    std::map<std::vector<bool>, uint8_t> classes;
+    for (unsigned int c = 0; c < 256; c++) {
+        std::vector<bool> signature;
+        for (auto& state : mStates) {
+            if (state.kind == Kind::kLiteral) {
+                signature.push_back((unsigned char) state.literal == c);
+            } else if (state.kind == Kind::kClass) {
+                signature.push_back(mClasses[state.arg].test(c));
+            }
+        }
+        auto it = classes.emplace(signature, classes.size()).first;
+        mByteClass[c] = it->second;
+    }
+    mByteClasses = classes.size();
+}
+
+void GlobMatcher::compile() {
+    mTransitions.clear();
+    mAccept.clear();
+    buildByteClasses();
+
+    // One representative byte per class drives the construction
+    std::vector<unsigned char> representative(mByteClasses);
+    for (int c = 255; c >= 0; c--) {
+        representative[mByteClass[c]] = c;
+    }
+
+    std::map<StateSet, DfaState> ids;
+    std::vector<StateSet> sets;
+    StateSet start = initial();
+    ids[start] = 0;
+    sets.push_back(start);
+
+    StateSet next(start.size(), 0);
+    for (size_t id = 0; id < sets.size(); id++) {
+        mAccept.push_back(accepting(sets[id]));
+        mTransitions.resize(sets.size() * mByteClasses, -1);
+
+        for (size_t cls = 0; cls < mByteClasses; cls++) {
+            if (!step(sets[id], representative[cls], next)) {
+                continue;
+            }
+            auto it = ids.find(next);
+            if (it == ids.end()) {
+                if (sets.size() == kMaxDfaStates) {
+                    LOG(WARNING) << "Glob patterns need more than " << kMaxDfaStates
+                            << " DFA states, matching without DFA";
+                    mTransitions.clear();
+                    mAccept.clear();
+                    return;
+                }
+                it = ids.emplace(next, sets.size()).first;
+                sets.push_back(next);
+                mTransitions.resize(sets.size() * mByteClasses, -1);
+            }
+            mTransitions[id * mByteClasses + cls] = it->second;
+        }
+    }
+}
+
+int GlobMatcher::match(const std::string& str) const {
+    if (mStates.empty()) {
+        return -1;
+    }
+
+    if (!mAccept.empty()) {
+        int state = 0;
+        for (unsigned char c : str) {
+            state = mTransitions[state * mByteClasses + mByteClass[c]];
+            if (state < 0) {
+                return -1;
+            }
+        }
+        return mAccept[state];
+    }
+
+    StateSet current = initial();
+    StateSet next(current.size(), 0);
+    for (unsigned char c : str) {
+        if (!step(current, c, next)) {
+            return -1;
+        }
+        current.swap(next);
+    }
+    return accepting(current);
+}
+
+}  // namespace droidvold
+}  // namespace android
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_GLOB_MATCHER_H
+#define ANDROID_VOLD_GLOB_MATCHER_H
+
+#include "Utils.h"
+
+#include <stdint.h>
+
+#include <bitset>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * A set of fnmatch(3) patterns (flags 0: '*', '?', '[...]' and '\' escapes,
+ * '*' also matching '/') compiled into one automaton. match() walks the
+ * input once for all patterns together instead of calling fnmatch per
+ * pattern.
+ *
+ * compile() builds a DFA by subset construction over byte equivalence
+ * classes. Until then, or should a pattern set ever need more than
+ * kMaxDfaStates, matching falls back to simulating the NFA.
+ */
+class GlobMatcher {
+public:
+    GlobMatcher() : mPatterns(0), mByteClass(), mByteClasses(0) {}
+
+    /* Parses pattern and returns its index */
+    int add(const std::string& pattern);
+    /* Builds the DFA once all patterns are added */
+    void compile();
+    /* Index of the first added pattern that matches str, or -1 */
+    int match(const std::string& str) const;
+
+    size_t size() const { return mPatterns; }
+    /* Number of DFA states, 0 when matching through the NFA */
+    size_t getDfaSize() const { return mAccept.size(); }
+
+private:
+    /* DFA state ID, negative for the dead state */
+    typedef int16_t DfaState;
+    static const size_t kMaxDfaStates = 4096;
+    static_assert(kMaxDfaStates - 1 <= (size_t) std::numeric_limits<DfaState>::max(),
+            "DFA state IDs must fit DfaState");
+
+    enum class Kind : uint8_t {
+        kLiteral,
+        kAny,
+        kClass,
+        kStar,
+        kAccept,
+    };
+
+    struct State {
+        Kind kind;
+        char literal;
+        /* Index into mClasses for kClass, pattern index for kAccept */
+        int arg;
+    };
+
+    typedef std::vector<uint64_t> StateSet;
+
+    /* NFA, each pattern's states followed by its kAccept */
+    std::vector<State> mStates;
+    std::vector<std::bitset<256>> mClasses;
+    size_t mPatterns;
+
+    /* Bytes no pattern tells apart share one equivalence class */
+    uint8_t mByteClass[256];
+    size_t mByteClasses;
+    /* DFA transitions indexed by state * mByteClasses + class, -1 is dead */
+    std::vector<DfaState> mTransitions;
+    /* Winning pattern per DFA state, or -1 */
+    std::vector<int> mAccept;
+
+    void enter(StateSet& set, size_t state) const;
+    StateSet initial() const;
+    bool step(const StateSet& current, unsigned char c, StateSet& next) const;
+    int accepting(const StateSet& set) const;
+    void buildByteClasses();
+
+    DISALLOW_COPY_AND_ASSIGN(GlobMatcher);
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JobExecutor.h"
+#include "ResponseCode.h"
+
+#include <android-base/logging.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace android {
+namespace droidvold {
+
+JobExecutor::JobExecutor(size_t maxThreads, const Notifier& notifier) :
+        mMaxThreads(std::max(maxThreads, (size_t) 1)), mNotifier(notifier), mThreads(0),
+        mNextId(1) {
+}
+
+JobExecutor::~JobExecutor() {
+}
+
+uint64_t JobExecutor::submit(const std::string& op, const std::string& volId,
+        const std::string& diskId, const Work& work) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Job job = { mNextId++, op, volId, diskId, work };
+    mPending.push_back(job);
+    LOG(DEBUG) << "Queued job " << job.id << " " << op << " "
+            << (volId.empty() ? diskId : volId);
+
+    if (mThreads < mMaxThreads) {
+        mThreads++;
+        std::thread(&JobExecutor::run, this).detach();
+    }
+    return job.id;
+}
+
+status_t JobExecutor::cancel(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (std::any_of(mRunning.begin(), mRunning.end(),
+                [id](const Job& job) { return job.id == id; })) {
+            return -EBUSY;
+        }
+
+        auto it = std::find_if(mPending.begin(), mPending.end(),
+                [id](const Job& job) { return job.id == id; });
+        if (it == mPending.end()) {
+            return -ENOENT;
+        }
+        mPending.erase(it);
+    }
+
+    mNotifier(StorageEvent(ResponseCode::JobCancelled, "").addUnsigned(id));
+    return OK;
+}
+
+size_t JobExecutor::getPendingCount() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mPending.size();
+}
+
+size_t JobExecutor::getRunningCount() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mRunning.size();
+}
+
+bool JobExecutor::overlaps(const Job& a, const Job& b) {
+    if (!a.volId.empty() && a.volId == b.volId) {
+        return true;
+    }
+    // A whole-disk job covers every volume on that disk
+    return !a.diskId.empty() && a.diskId == b.diskId
+            && (a.volId.empty() || b.volId.empty());
+}
+
+bool JobExecutor::takeRunnableLocked(Job& job) {
+    // Oldest job that overlaps neither a running job nor an older pending
+    // one, so overlapping jobs keep their submission order
+    std::vector<const Job*> ahead;
+    for (auto& running : mRunning) {
+        ahead.push_back(&running);
+    }
+    for (auto it = mPending.begin(); it != mPending.end(); ++it) {
+        bool blocked = std::any_of(ahead.begin(), ahead.end(),
+                [&it](const Job* other) { return overlaps(*other, *it); });
+        if (!blocked) {
+            job = std::move(*it);
+            mPending.erase(it);
+            mRunning.push_back({ job.id, job.op, job.volId, job.diskId, nullptr });
+            return true;
+        }
+        ahead.push_back(&*it);
+    }
+    return false;
+}
+
+void JobExecutor::run() {
+    while (true) {
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (!takeRunnableLocked(job)) {
+                // Whoever finishes the blocking job keeps going with it
+                mThreads--;
+                return;
+            }
+        }
+
+        uint64_t id = job.id;
+        mNotifier(StorageEvent(ResponseCode::JobStarted, "")
+                .addUnsigned(id).add(job.op).add(job.volId.empty() ? job.diskId : job.volId));
+        status_t res = job.work([this, id](uint64_t done, uint64_t total) {
+            mNotifier(StorageEvent(ResponseCode::JobProgress, "")
+                    .addUnsigned(id).addUnsigned(done).addUnsigned(total));
+        });
+        mNotifier(StorageEvent(ResponseCode::JobCompleted, "").addUnsigned(id).add(res));
+
+        std::lock_guard<std::mutex> lock(mLock);
+        mRunning.erase(std::find_if(mRunning.begin(), mRunning.end(),
+                [id](const Job& running) { return running.id == id; }));
+    }
+}
+
+}  // namespace droidvold
+}  // namespace android
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_JOB_EXECUTOR_H
+#define ANDROID_VOLD_JOB_EXECUTOR_H
+
+#include "StorageEvent.h"
+#include "Utils.h"
+
+#include <utils/Errors.h>
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Runs slow volume operations (mount, unmount, format) off the binder
+ * threads. Each job gets an ID when submitted and reports through the
+ * notifier when it starts and when it finishes or is cancelled. Work
+ * that proceeds in steps, such as mounting a whole disk, also reports
+ * JobProgress after each step.
+ *
+ * A job holds either one volume or a whole disk. Jobs that overlap, on
+ * the same volume or on a disk and one of its volumes, run one at a time
+ * in submission order; others run in parallel on up to maxThreads
+ * threads, which are spawned on demand and exit once nothing is runnable.
+ */
+class JobExecutor {
+public:
+    /* Reports that done of total steps have finished */
+    typedef std::function<void(uint64_t done, uint64_t total)> Progress;
+    typedef std::function<status_t(const Progress&)> Work;
+    typedef std::function<void(const StorageEvent&)> Notifier;
+
+    JobExecutor(size_t maxThreads, const Notifier& notifier);
+    ~JobExecutor();
+
+    /*
+     * Queues work on volId, which lives on diskId, and returns the job
+     * ID. An empty volId takes the whole disk; diskId may be empty for
+     * volumes without a disk.
+     */
+    uint64_t submit(const std::string& op, const std::string& volId,
+            const std::string& diskId, const Work& work);
+    /*
+     * Drops a job that has not started yet. A running job can't be
+     * interrupted safely and yields -EBUSY; unknown IDs yield -ENOENT.
+     */
+    status_t cancel(uint64_t id);
+
+    size_t getPendingCount();
+    size_t getRunningCount();
+
+private:
+    struct Job {
+        uint64_t id;
+        std::string op;
+        /* Empty when the job holds its whole disk */
+        std::string volId;
+        std::string diskId;
+        Work work;
+    };
+
+    size_t mMaxThreads;
+    Notifier mNotifier;
+
+    std::mutex mLock;
+    std::deque<Job> mPending;
+    /* Running jobs, without their work */
+    std::vector<Job> mRunning;
+    size_t mThreads;
+    uint64_t mNextId;
+
+    static bool overlaps(const Job& a, const Job& b);
+    bool takeRunnableLocked(Job& job);
+    void run();
+
+    DISALLOW_COPY_AND_ASSIGN(JobExecutor);
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
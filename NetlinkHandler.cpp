@@ -19,39 +19,209 @@
 #include <errno.h>
 #include <string.h>
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 #define LOG_TAG "droidVold"
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
 
 #include <sysutils/NetlinkEvent.h>
+#include <sysutils/SocketClient.h>
 #include "NetlinkHandler.h"
 #include "VolumeManager.h"
 
+using android::droidvold::UeventCoalescer;
+
+/* Quiet period used to collapse add/change/remove bursts, 0 disables */
+static const int kDefaultCoalesceMs = 50;
+
 NetlinkHandler::NetlinkHandler(int listenerSocket) :
-                NetlinkListener(listenerSocket) {
+                NetlinkListener(listenerSocket), mDelivered(0), mFiltered(0), mOverflows(0),
+                mResyncs(0), mReceiveBufferSize(0) {
+    int size = 0;
+    socklen_t len = sizeof(size);
+    if (!getsockopt(listenerSocket, SOL_SOCKET, SO_RCVBUF, &size, &len)) {
+        // The kernel reports twice the value that was set
+        mReceiveBufferSize = size / 2;
+    }
 }
 
 NetlinkHandler::~NetlinkHandler() {
 }
 
 int NetlinkHandler::start() {
+    char path[PROPERTY_VALUE_MAX];
+    if (property_get("droidvold.uevent_record", path, "") > 0) {
+        mRecorder.open(path);
+    }
+
+    int window = property_get_int32("droidvold.uevent_coalesce_ms", kDefaultCoalesceMs);
+    mCoalescer.reset(new UeventCoalescer([](const UeventCoalescer::Batch& events) {
+        VolumeManager::Instance()->handleBlockEvents(events);
+    }, std::chrono::milliseconds(std::max(window, 0))));
+    mCoalescer->start();
+
     return this->startListener();
 }
 
 int NetlinkHandler::stop() {
-    return this->stopListener();
+    int res = this->stopListener();
+    if (mCoalescer) {
+        mCoalescer->stop();
+    }
+    mRecorder.close();
+    return res;
 }
 
-void NetlinkHandler::onEvent(NetlinkEvent *evt) {
-    VolumeManager *vm = VolumeManager::Instance();
-    const char *subsys = evt->getSubsystem();
+uint64_t NetlinkHandler::getCollapsedCount() {
+    return mCoalescer ? mCoalescer->getCollapsedCount() : 0;
+}
+
+void NetlinkHandler::resetBatch() {
+    // recvmmsg() overwrites the lengths and flags, so re-arm every slot
+    for (int i = 0; i < kBatchSize; i++) {
+        mIovs[i].iov_base = mBuffers[i];
+        mIovs[i].iov_len = kMessageSize;
 
-    if (!subsys) {
-        SLOGW("No subsystem found in netlink event");
+        struct msghdr *hdr = &mMsgs[i].msg_hdr;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = &mAddrs[i];
+        hdr->msg_namelen = sizeof(mAddrs[i]);
+        hdr->msg_iov = &mIovs[i];
+        hdr->msg_iovlen = 1;
+        hdr->msg_control = mControl[i];
+        hdr->msg_controllen = sizeof(mControl[i]);
+        mMsgs[i].msg_len = 0;
+    }
+}
+
+/*
+ * Same policy as uevent_kernel_multicast_uid_recv(): only accept multicast
+ * messages sent by the kernel itself.
+ */
+bool NetlinkHandler::isTrustedMessage(struct msghdr *hdr) {
+    if (hdr->msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        SLOGW("Dropping truncated uevent");
+        return false;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        return false;
+    }
+
+    struct ucred *cred = (struct ucred *) CMSG_DATA(cmsg);
+    if (cred->uid != 0) {
+        return false;
+    }
+
+    struct sockaddr_nl *addr = (struct sockaddr_nl *) hdr->msg_name;
+    if (addr->nl_groups == 0 || addr->nl_pid != 0) {
+        return false;
+    }
+
+    return true;
+}
+
+void NetlinkHandler::growReceiveBuffer(int socket) {
+    int size = std::min(std::max((int) mReceiveBufferSize, 64 * 1024) * 2,
+            kMaxReceiveBufferSize);
+    if (size <= mReceiveBufferSize) {
+        return;
+    }
+
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) {
+        SLOGE("Unable to grow uevent socket buffer: %s", strerror(errno));
         return;
     }
+    SLOGI("Grew uevent socket buffer to %d bytes", size);
+    mReceiveBufferSize = size;
+}
+
+bool NetlinkHandler::onDataAvailable(SocketClient *cli) {
+    int socket = cli->getSocket();
+    std::vector<std::shared_ptr<NetlinkEvent>> events;
+    bool overflowed = false;
+
+    for (int round = 0; round < kMaxBatchesPerWakeup; round++) {
+        resetBatch();
+
+        int count = TEMP_FAILURE_RETRY(recvmmsg(socket, mMsgs, kBatchSize,
+                MSG_DONTWAIT, NULL));
+        if (count < 0) {
+            if (errno == ENOBUFS) {
+                // The kernel dropped uevents; it reports this once, so
+                // keep draining what it did queue.
+                SLOGW("uevent socket overflowed, will resync with sysfs");
+                mOverflows++;
+                overflowed = true;
+                growReceiveBuffer(socket);
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                SLOGE("recvmmsg failed (%s)", strerror(errno));
+            }
+            break;
+        }
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < count; i++) {
+            if (!isTrustedMessage(&mMsgs[i].msg_hdr)) {
+                continue;
+            }
+
+            std::shared_ptr<NetlinkEvent> evt = std::make_shared<NetlinkEvent>();
+            if (!evt->decode(mBuffers[i], mMsgs[i].msg_len, NETLINK_FORMAT_ASCII)) {
+                SLOGE("Error decoding NetlinkEvent");
+                continue;
+            }
+
+            const char *subsys = evt->getSubsystem();
+            if (!subsys) {
+                SLOGW("No subsystem found in netlink event");
+                continue;
+            }
+
+            if (!strcmp(subsys, "block")) {
+                if (mRecorder.isOpen()) {
+                    mRecorder.record(evt.get(), now);
+                }
+                events.push_back(std::move(evt));
+            } else {
+                mFiltered++;
+            }
+        }
+
+        if (count < kBatchSize) {
+            break;
+        }
+    }
 
-    if (!strcmp(subsys, "block")) {
-        vm->handleBlockEvent(evt);
+    if (!events.empty()) {
+        mRecorder.flush();
+        mDelivered += events.size();
+        mCoalescer->submit(events);
     }
+
+    if (overflowed) {
+        // Submitted after the live events so the coalescer can merge any
+        // duplicates with what actually arrived.
+        std::vector<std::shared_ptr<NetlinkEvent>> resync;
+        VolumeManager::Instance()->buildResyncEvents(resync);
+        mResyncs++;
+        if (!resync.empty()) {
+            mCoalescer->submit(resync);
+        }
+    }
+
+    return true;
+}
+
+// Never called: onDataAvailable() decodes whole batches itself and hands
+// them to the coalescer. NetlinkListener just requires an override.
+void NetlinkHandler::onEvent(NetlinkEvent *evt) {
 }
@@ -17,8 +17,17 @@
 #ifndef _NETLINKHANDLER_H
 #define _NETLINKHANDLER_H
 
+#include <sys/socket.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <linux/netlink.h>
+
 #include <sysutils/NetlinkListener.h>
 
+#include "UeventCoalescer.h"
+#include "UeventRecorder.h"
+
 class NetlinkHandler: public NetlinkListener {
 
 public:
@@ -28,7 +37,44 @@ public:
     int start(void);
     int stop(void);
 
+    uint64_t getDeliveredCount() { return mDelivered; }
+    uint64_t getFilteredCount() { return mFiltered; }
+    uint64_t getCollapsedCount();
+    uint64_t getOverflowCount() { return mOverflows; }
+    uint64_t getResyncCount() { return mResyncs; }
+    int getReceiveBufferSize() { return mReceiveBufferSize; }
+
 protected:
+    virtual bool onDataAvailable(SocketClient *cli);
     virtual void onEvent(NetlinkEvent *evt);
+
+private:
+    /* Max number of datagrams pulled by a single recvmmsg() */
+    static const int kBatchSize = 32;
+    /* Max number of recvmmsg() calls per wakeup, bounds batch latency */
+    static const int kMaxBatchesPerWakeup = 8;
+    /* Kernel uevents are capped well below this (UEVENT_BUFFER_SIZE) */
+    static const size_t kMessageSize = 8192;
+    /* Upper bound for growing SO_RCVBUFFORCE after an overflow */
+    static const int kMaxReceiveBufferSize = 4 * 1024 * 1024;
+
+    struct mmsghdr mMsgs[kBatchSize];
+    struct iovec mIovs[kBatchSize];
+    struct sockaddr_nl mAddrs[kBatchSize];
+    char mControl[kBatchSize][CMSG_SPACE(sizeof(struct ucred))];
+    char mBuffers[kBatchSize][kMessageSize];
+
+    std::atomic<uint64_t> mDelivered;
+    std::atomic<uint64_t> mFiltered;
+    std::atomic<uint64_t> mOverflows;
+    std::atomic<uint64_t> mResyncs;
+    std::atomic<int> mReceiveBufferSize;
+
+    android::droidvold::UeventRecorder mRecorder;
+    std::unique_ptr<android::droidvold::UeventCoalescer> mCoalescer;
+
+    void resetBatch();
+    bool isTrustedMessage(struct msghdr *hdr);
+    void growReceiveBuffer(int socket);
 };
 #endif
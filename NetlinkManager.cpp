@@ -24,8 +24,11 @@
 #include <sys/types.h>
 #include <sys/un.h>
 
+#include <linux/filter.h>
 #include <linux/netlink.h>
 
+#include <vector>
+
 #define LOG_TAG "droidVold"
 
 #include <cutils/log.h>
@@ -41,8 +44,59 @@ NetlinkManager *NetlinkManager::Instance() {
     return sInstance;
 }
 
+/*
+ * Kernel uevents look like "action@devpath\0ACTION=action\0DEVPATH=devpath\0
+ * SUBSYSTEM=subsys\0...", with the first three keys always emitted in that
+ * order by kobject_uevent_env(). Given the offset i of the header's NUL, the
+ * SUBSYSTEM key therefore starts at 2 * i + 17.
+ *
+ * Classic BPF has no loops, so the search for that NUL is unrolled over the
+ * first kFilterScanLength bytes; headers longer than that are let through
+ * and left to the userspace check in NetlinkHandler.
+ */
+static const unsigned int kFilterScanLength = 512;
+
+int NetlinkManager::attachBlockFilter() {
+    std::vector<struct sock_filter> prog;
+    const unsigned int common = kFilterScanLength * 4 + 1;
+
+    for (unsigned int i = 0; i < kFilterScanLength; i++) {
+        unsigned int next = prog.size() + 4;
+        prog.push_back((struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, i));
+        prog.push_back((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 2));
+        prog.push_back((struct sock_filter) BPF_STMT(BPF_LDX | BPF_IMM, 2 * i + 17));
+        prog.push_back((struct sock_filter) BPF_STMT(BPF_JMP | BPF_JA, common - next));
+    }
+    // No NUL in range, accept and let userspace decide
+    prog.push_back((struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+
+    // "SUBSYSTEM=block\0" as four big-endian words, relative to X
+    prog.push_back((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_IND, 0));
+    prog.push_back((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x53554253, 0, 7));
+    prog.push_back((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_IND, 4));
+    prog.push_back((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x59535445, 0, 5));
+    prog.push_back((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_IND, 8));
+    prog.push_back((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x4d3d626c, 0, 3));
+    prog.push_back((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_IND, 12));
+    prog.push_back((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6f636b00, 0, 1));
+    prog.push_back((struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+    prog.push_back((struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0));
+
+    struct sock_fprog fprog;
+    fprog.len = prog.size();
+    fprog.filter = prog.data();
+
+    if (setsockopt(mSock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
 NetlinkManager::NetlinkManager() {
     mBroadcaster = NULL;
+    mHandler = NULL;
+    mSock = -1;
+    mFilterAttached = false;
 }
 
 NetlinkManager::~NetlinkManager() {
@@ -74,6 +128,13 @@ int NetlinkManager::start() {
         goto out;
     }
 
+    if (attachBlockFilter() < 0) {
+        // Not fatal, NetlinkHandler still drops non-block events itself
+        SLOGW("Unable to attach uevent socket filter: %s", strerror(errno));
+    } else {
+        mFilterAttached = true;
+    }
+
     if (bind(mSock, (struct sockaddr *) &nladdr, sizeof(nladdr)) < 0) {
         SLOGE("Unable to bind uevent socket: %s", strerror(errno));
         goto out;
@@ -92,6 +153,30 @@ out:
     return -1;
 }
 
+uint64_t NetlinkManager::getDeliveredCount() {
+    return mHandler ? mHandler->getDeliveredCount() : 0;
+}
+
+uint64_t NetlinkManager::getFilteredCount() {
+    return mHandler ? mHandler->getFilteredCount() : 0;
+}
+
+uint64_t NetlinkManager::getCollapsedCount() {
+    return mHandler ? mHandler->getCollapsedCount() : 0;
+}
+
+uint64_t NetlinkManager::getOverflowCount() {
+    return mHandler ? mHandler->getOverflowCount() : 0;
+}
+
+uint64_t NetlinkManager::getResyncCount() {
+    return mHandler ? mHandler->getResyncCount() : 0;
+}
+
+int NetlinkManager::getReceiveBufferSize() {
+    return mHandler ? mHandler->getReceiveBufferSize() : 0;
+}
+
 int NetlinkManager::stop() {
     int status = 0;
 
@@ -34,6 +34,7 @@ private:
     DroidVold       *mBroadcaster;
     NetlinkHandler       *mHandler;
     int                  mSock;
+    bool                 mFilterAttached;
 
 public:
     virtual ~NetlinkManager();
@@ -44,9 +45,23 @@ public:
     void setBroadcaster(DroidVold *sl) { mBroadcaster = sl; }
     DroidVold *getBroadcaster() { return mBroadcaster; }
 
+    bool isFilterAttached() { return mFilterAttached; }
+    /* Block events handed to VolumeManager */
+    uint64_t getDeliveredCount();
+    /* Events that woke us up but were dropped in userspace */
+    uint64_t getFilteredCount();
+    /* Events collapsed away by the coalescing stage */
+    uint64_t getCollapsedCount();
+    /* Times the socket overflowed (ENOBUFS) and we resynced from sysfs */
+    uint64_t getOverflowCount();
+    uint64_t getResyncCount();
+    int getReceiveBufferSize();
+
     static NetlinkManager *Instance();
 
 private:
     NetlinkManager();
+
+    int attachBlockFilter();
 };
 #endif
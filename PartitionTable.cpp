@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PartitionTable.h"
+#include "Checksum.h"
+#include "Utils.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace droidvold {
+
+/* MBR, primary GPT header and 128 entries, even with 4K sectors */
+static const size_t kHeadSize = 32 * 1024;
+/* DISK_MAX_PARTS; the kernel ignores partitions numbered higher */
+static const int kMaxPartitions = 256;
+/* The kernel stops following a logical partition chain after this */
+static const int kMaxLogicalChain = 100;
+/* Bounds the entry array read for a corrupt header */
+static const uint32_t kMaxGptEntries = 16384;
+
+static const size_t kMbrTableOffset = 0x1be;
+static const uint8_t kMbrTypeGpt = 0xee;
+static const size_t kGptHeaderMinSize = 92;
+static const size_t kGptEntrySize = 128;
+
+namespace {
+
+uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+uint32_t le32(const uint8_t* p) { return le16(p) | ((uint32_t) le16(p + 2) << 16); }
+uint64_t le64(const uint8_t* p) { return le32(p) | ((uint64_t) le32(p + 4) << 32); }
+
+/* CRC-32 as used by GPT, i.e. the kernel's efi_crc32() */
+uint32_t gptCrc(const uint8_t* data, size_t len) {
+    return ~Crc32(~0u, data, len);
+}
+
+/*
+ * The start of the device, read once, plus reads further in for logical
+ * partitions and the backup GPT. A pointer from read() stays valid until
+ * the next read() beyond the head.
+ */
+class Device {
+public:
+    explicit Device(int fd) : mFd(fd), mSize(0), mSectorSize(512) {}
+
+    status_t load() {
+        off64_t size = lseek64(mFd, 0, SEEK_END);
+        if (size < 0) {
+            return -errno;
+        }
+        mSize = size;
+
+        int sectorSize;
+        if (ioctl(mFd, BLKSSZGET, &sectorSize) == 0 && sectorSize >= 512) {
+            mSectorSize = sectorSize;
+        }
+
+        mHead.resize(std::min<uint64_t>(kHeadSize, mSize));
+        return readFully(mHead.data(), mHead.size(), 0) ? OK : -EIO;
+    }
+
+    const uint8_t* read(uint64_t off, size_t len) {
+        if (off + len <= mHead.size()) {
+            return mHead.data() + off;
+        }
+        if (off > mSize || len > mSize - off) {
+            return nullptr;
+        }
+        mExtra.resize(len);
+        return readFully(mExtra.data(), len, off) ? mExtra.data() : nullptr;
+    }
+
+    uint64_t getSize() { return mSize; }
+    uint32_t getSectorSize() { return mSectorSize; }
+
+private:
+    int mFd;
+    uint64_t mSize;
+    uint32_t mSectorSize;
+    std::vector<uint8_t> mHead;
+    std::vector<uint8_t> mExtra;
+
+    bool readFully(uint8_t* buf, size_t len, uint64_t off) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = TEMP_FAILURE_RETRY(pread64(mFd, buf + done, len - done, off + done));
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(Device);
+};
+
+bool hasMbrSignature(const uint8_t* sector) {
+    return sector[510] == 0x55 && sector[511] == 0xaa;
+}
+
+bool isExtended(uint8_t type) {
+    // DOS, Windows 98 and Linux extended
+    return type == 0x05 || type == 0x0f || type == 0x85;
+}
+
+/* Mixed-endian on disk: the first three fields are little-endian */
+std::string formatGuid(const uint8_t* g) {
+    return StringPrintf("%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+            le32(g), le16(g + 4), le16(g + 6), g[8], g[9], g[10], g[11], g[12], g[13],
+            g[14], g[15]);
+}
+
+bool isZero(const uint8_t* p, size_t len) {
+    return std::all_of(p, p + len, [](uint8_t b) { return b == 0; });
+}
+
+/* GPT names are UTF-16LE; anything outside the BMP becomes U+FFFD */
+std::string decodeName(const uint8_t* name, size_t units) {
+    std::string out;
+    for (size_t i = 0; i < units; i++) {
+        unsigned c = le16(name + 2 * i);
+        if (c == 0) {
+            break;
+        }
+        if (c >= 0xd800 && c < 0xe000) {
+            c = 0xfffd;
+            if (i + 1 < units && le16(name + 2 * (i + 1)) >= 0xdc00
+                    && le16(name + 2 * (i + 1)) < 0xe000) {
+                i++;
+            }
+        }
+        if (c < 0x80) {
+            out += (char) c;
+        } else if (c < 0x800) {
+            out += (char) (0xc0 | (c >> 6));
+            out += (char) (0x80 | (c & 0x3f));
+        } else {
+            out += (char) (0xe0 | (c >> 12));
+            out += (char) (0x80 | ((c >> 6) & 0x3f));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+    }
+    return out;
+}
+
+/*
+ * A GPT needs an MBR with an 0xEE entry starting at LBA 1. Any other
+ * non-empty entry makes it hybrid.
+ */
+bool isProtectiveMbr(const uint8_t* mbr, bool& hybrid) {
+    if (!hasMbrSignature(mbr)) {
+        return false;
+    }
+
+    bool protective = false;
+    hybrid = false;
+    for (int slot = 0; slot < 4; slot++) {
+        const uint8_t* p = mbr + kMbrTableOffset + slot * 16;
+        if (p[4] == kMbrTypeGpt && le32(p + 8) == 1) {
+            protective = true;
+        } else if (p[4] != kMbrTypeGpt && p[4] != 0) {
+            hybrid = true;
+        }
+    }
+    return protective;
+}
+
+/* Validates the GPT header at lba and its entries like is_gpt_valid() */
+bool readGpt(Device& dev, uint64_t lba, uint64_t lastLba, PartitionTable& table) {
+    uint32_t ss = dev.getSectorSize();
+    const uint8_t* h = dev.read(lba * ss, ss);
+    if (!h || memcmp(h, "EFI PART", 8)) {
+        return false;
+    }
+
+    uint32_t headerSize = le32(h + 12);
+    if (headerSize < kGptHeaderMinSize || headerSize > ss) {
+        return false;
+    }
+    std::vector<uint8_t> header(h, h + headerSize);
+    memset(header.data() + 16, 0, 4);
+    if (gptCrc(header.data(), headerSize) != le32(h + 16)) {
+        LOG(WARNING) << "GPT header at LBA " << lba << " has a bad CRC";
+        return false;
+    }
+
+    uint64_t firstUsable = le64(h + 40);
+    uint64_t lastUsable = le64(h + 48);
+    if (le64(h + 24) != lba || firstUsable > lastLba || lastUsable > lastLba
+            || lastUsable < firstUsable) {
+        return false;
+    }
+
+    uint64_t entriesLba = le64(h + 72);
+    uint32_t numEntries = le32(h + 80);
+    uint32_t entriesCrc = le32(h + 88);
+    std::string diskGuid = formatGuid(h + 56);
+    if (le32(h + 84) != kGptEntrySize || numEntries > kMaxGptEntries) {
+        return false;
+    }
+
+    size_t entriesSize = numEntries * kGptEntrySize;
+    const uint8_t* entries = dev.read(entriesLba * ss, entriesSize);
+    if (!entries || gptCrc(entries, entriesSize) != entriesCrc) {
+        LOG(WARNING) << "GPT entries of header at LBA " << lba << " are corrupt";
+        return false;
+    }
+
+    std::vector<PartitionTable::Partition> parts;
+    for (uint32_t i = 0; i < numEntries && i < kMaxPartitions - 1; i++) {
+        const uint8_t* e = entries + i * kGptEntrySize;
+        uint64_t start = le64(e + 32);
+        uint64_t end = le64(e + 40);
+        if (isZero(e, 16) || start > lastLba || end > lastLba || end < start) {
+            continue;
+        }
+
+        PartitionTable::Partition part;
+        part.number = i + 1;
+        part.offset = start * ss;
+        part.size = (end - start + 1) * ss;
+        part.mbrType = 0;
+        part.container = false;
+        part.typeGuid = formatGuid(e);
+        part.partGuid = formatGuid(e + 16);
+        part.attributes = le64(e + 48);
+        part.name = decodeName(e + 56, 36);
+        parts.push_back(part);
+    }
+
+    table.diskGuid = diskGuid;
+    table.partitions = std::move(parts);
+    return true;
+}
+
+void addMbrPartition(PartitionTable& table, int number, uint64_t offset, uint64_t size,
+        uint8_t type, bool container) {
+    PartitionTable::Partition part;
+    part.number = number;
+    part.offset = offset;
+    part.size = size;
+    part.mbrType = type;
+    part.container = container;
+    part.attributes = 0;
+    table.partitions.push_back(part);
+}
+
+/*
+ * Walks the chain of EBRs in the extended partition at first, as the
+ * kernel's parse_extended() does. Logical partitions are numbered from 5
+ * in chain order; offsets in an EBR are relative to that EBR for data and
+ * to the extended partition for the next link.
+ */
+void readLogicals(Device& dev, uint64_t first, uint64_t firstSize, PartitionTable& table) {
+    uint32_t ss = dev.getSectorSize();
+    uint64_t thisLba = first;
+    uint64_t thisSize = firstSize;
+    int next = 5;
+
+    for (int loop = 0; loop < kMaxLogicalChain && next < kMaxPartitions; loop++) {
+        const uint8_t* ebr = dev.read(thisLba * ss, 512);
+        if (!ebr || !hasMbrSignature(ebr)) {
+            return;
+        }
+
+        const uint8_t* p = ebr + kMbrTableOffset;
+        for (int i = 0; i < 4; i++) {
+            const uint8_t* e = p + i * 16;
+            uint64_t offs = le32(e + 8);
+            uint64_t size = le32(e + 12);
+            if (!size || isExtended(e[4])) {
+                continue;
+            }
+            // The 3rd and 4th entries sometimes hold garbage
+            if (i >= 2 && (offs + size > thisSize || thisLba + offs < first
+                    || thisLba + offs + size > first + firstSize)) {
+                continue;
+            }
+
+            addMbrPartition(table, next++, (thisLba + offs) * ss, size * ss, e[4], false);
+            if (next == kMaxPartitions) {
+                return;
+            }
+        }
+
+        int link = -1;
+        for (int i = 0; i < 4 && link < 0; i++) {
+            if (le32(p + i * 16 + 12) && isExtended(p[i * 16 + 4])) {
+                link = i;
+            }
+        }
+        if (link < 0) {
+            return;
+        }
+        thisLba = first + le32(p + link * 16 + 8);
+        thisSize = le32(p + link * 16 + 12);
+    }
+}
+
+/* Same acceptance rules as the kernel's msdos_partition() */
+bool readMbr(Device& dev, const uint8_t* mbr, PartitionTable& table) {
+    if (!hasMbrSignature(mbr)) {
+        return false;
+    }
+
+    for (int slot = 0; slot < 4; slot++) {
+        const uint8_t* p = mbr + kMbrTableOffset + slot * 16;
+        // A boot sector, e.g. FAT on the whole disk, not a partition table
+        if (p[0] != 0 && p[0] != 0x80) {
+            return false;
+        }
+        // A GPT whose headers were both corrupt
+        if (p[4] == kMbrTypeGpt) {
+            return false;
+        }
+    }
+
+    uint32_t ss = dev.getSectorSize();
+    for (int slot = 0; slot < 4; slot++) {
+        const uint8_t* p = mbr + kMbrTableOffset + slot * 16;
+        uint64_t start = le32(p + 8);
+        uint64_t size = le32(p + 12);
+        if (!size) {
+            continue;
+        }
+
+        if (isExtended(p[4])) {
+            // Exposed by the kernel as a stub of at most two sectors
+            addMbrPartition(table, slot + 1, start * ss,
+                    std::min<uint64_t>(size * ss, std::max<uint64_t>(ss, 1024)), p[4], true);
+            readLogicals(dev, start, size, table);
+        } else {
+            addMbrPartition(table, slot + 1, start * ss, size * ss, p[4], false);
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+const PartitionTable::Partition* PartitionTable::find(int number) const {
+    for (auto& part : partitions) {
+        if (part.number == number) {
+            return &part;
+        }
+    }
+    return nullptr;
+}
+
+status_t ReadPartitionTable(const std::string& path, PartitionTable& table) {
+    table = PartitionTable();
+
+    int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        PLOG(WARNING) << "Failed to open " << path << " for partition table";
+        return -errno;
+    }
+
+    Device dev(fd);
+    status_t res = dev.load();
+    const uint32_t ss = dev.getSectorSize();
+    const uint8_t* mbr = res == OK ? dev.read(0, 512) : nullptr;
+    if (res == OK && mbr && dev.getSize() >= 2 * ss) {
+        table.sectorSize = ss;
+        uint64_t lastLba = dev.getSize() / ss - 1;
+
+        bool hybrid;
+        if (isProtectiveMbr(mbr, hybrid)) {
+            if (readGpt(dev, 1, lastLba, table)) {
+                table.type = PartitionTable::Type::kGpt;
+            } else if (readGpt(dev, lastLba, lastLba, table)) {
+                LOG(WARNING) << path << " has a corrupt primary GPT; using the backup";
+                table.type = PartitionTable::Type::kGpt;
+                table.backup = true;
+            }
+            table.hybrid = hybrid && table.type == PartitionTable::Type::kGpt;
+        }
+        if (table.type == PartitionTable::Type::kUnknown && readMbr(dev, mbr, table)) {
+            table.type = PartitionTable::Type::kMbr;
+        }
+    }
+    close(fd);
+
+    if (res != OK) {
+        LOG(WARNING) << "Failed to read " << path << " for partition table: " << strerror(-res);
+        return res;
+    }
+
+    // Like the kernel, drop partitions past the end and truncate the rest
+    uint64_t size = dev.getSize();
+    auto& parts = table.partitions;
+    parts.erase(std::remove_if(parts.begin(), parts.end(),
+            [size](const PartitionTable::Partition& part) { return part.offset >= size; }),
+            parts.end());
+    for (auto& part : parts) {
+        part.size = std::min(part.size, size - part.offset);
+    }
+    return OK;
+}
+
+}  // namespace droidvold
+}  // namespace android
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_PARTITION_TABLE_H
+#define ANDROID_VOLD_PARTITION_TABLE_H
+
+#include <utils/Errors.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Partition layout of a disk, numbered the way the kernel's msdos and efi
+ * parsers number it, so each entry matches PARTN and the device name.
+ */
+struct PartitionTable {
+    enum class Type {
+        kUnknown,
+        kMbr,
+        kGpt,
+    };
+
+    struct Partition {
+        /* Kernel partition number */
+        int number;
+        /* Both in bytes */
+        uint64_t offset;
+        uint64_t size;
+        /* MBR system ID, 0 on GPT */
+        uint8_t mbrType;
+        /* MBR extended partition; holds the logical chain, no filesystem */
+        bool container;
+        /* GPT only, uppercase like the kGpt* constants */
+        std::string typeGuid;
+        std::string partGuid;
+        uint64_t attributes;
+        std::string name;
+    };
+
+    Type type;
+    /* GPT whose MBR also lists partitions; the GPT wins, as in the kernel */
+    bool hybrid;
+    /* GPT read from the backup header because the primary was corrupt */
+    bool backup;
+    uint32_t sectorSize;
+    std::string diskGuid;
+    std::vector<Partition> partitions;
+
+    PartitionTable() : type(Type::kUnknown), hybrid(false), backup(false), sectorSize(512) {}
+
+    const Partition* find(int number) const;
+};
+
+/*
+ * Parses MBR, with extended/logical chains and protective or hybrid MBRs,
+ * and GPT, falling back to the backup header. The MBR, the primary GPT
+ * header and its entries come from one read of the start of the device;
+ * only logical partition chains and a backup GPT cost more reads.
+ *
+ * Returns OK with Type::kUnknown if there is no table the kernel would
+ * accept.
+ */
+status_t ReadPartitionTable(const std::string& path, PartitionTable& table);
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
@@ -54,7 +54,12 @@ PublicVolume::~PublicVolume() {
 }
 
 status_t PublicVolume::readMetadata() {
-    status_t res = ReadPartMetadata(mDevPath, mFsType, mFsUuid, mFsLabel);
+    if (getDiskDevice() != 0) {
+        ReadPartMetadata(mDevPath, getDiskDevice(), getMediaGeneration(),
+                mFsType, mFsUuid, mFsLabel);
+    } else {
+        ReadPartMetadata(mDevPath, mFsType, mFsUuid, mFsLabel);
+    }
 
     if (VolumeManager::Instance()->getDebug())
         LOG(DEBUG) << "blkid get devPath=" << mDevPath << " fsType= " << mFsType;
@@ -219,9 +224,12 @@ status_t PublicVolume::doFormat(const std::string& fsType) {
         if (WipeBlockDevice(mDevPath) != OK) {
             LOG(WARNING) << getId() << " failed to wipe";
         }
-        if (vfat::Format(mDevPath, 0)) {
+        status_t res = vfat::Format(mDevPath, 0) ? -errno : OK;
+        // Even a failed format may have rewritten the superblock
+        ForgetPartMetadata(mDevPath);
+        if (res != OK) {
             LOG(ERROR) << getId() << " failed to format";
-            return -errno;
+            return res;
         }
     } else {
         LOG(ERROR) << "Unsupported filesystem " << fsType;
@@ -65,6 +65,8 @@ public:
     static const int DiskLabelChanged = 642;
     static const int DiskScanned = 643;
     static const int DiskSysPathChanged = 644;
+    static const int DiskVolumeMounted = 645;
+    static const int DiskAllMounted = 646;
     static const int DiskDestroyed = 649;
 
     static const int VolumeCreated = 650;
@@ -76,6 +78,16 @@ public:
     static const int VolumeInternalPathChanged = 656;
     static const int VolumeDestroyed = 659;
 
+    // Progress of jobs queued through the async mount/unmount/format calls
+    static const int JobStarted = 670;
+    static const int JobCompleted = 671;
+    static const int JobCancelled = 672;
+    static const int JobProgress = 673;
+
+    // Sent to a reconnecting client that missed too much, before the
+    // current state is replayed as creation events
+    static const int StateSnapshot = 680;
+
     static int convertFromErrno();
 };
 #endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StorageEvent.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace android {
+namespace droidvold {
+
+StorageEvent& StorageEvent::add(int64_t value) {
+    mArgs.push_back({ Arg::Type::kInt, value, "" });
+    return *this;
+}
+
+StorageEvent& StorageEvent::addUnsigned(uint64_t value) {
+    mArgs.push_back({ Arg::Type::kUnsigned, (int64_t) value, "" });
+    return *this;
+}
+
+StorageEvent& StorageEvent::add(const std::string& text) {
+    mArgs.push_back({ Arg::Type::kString, 0, text });
+    return *this;
+}
+
+StorageEvent& StorageEvent::addQuoted(const std::string& text) {
+    mArgs.push_back({ Arg::Type::kQuotedString, 0, text });
+    return *this;
+}
+
+std::string StorageEvent::toString() const {
+    std::string out(mId);
+    char buf[24];
+    for (auto& arg : mArgs) {
+        if (!out.empty()) {
+            out += ' ';
+        }
+        switch (arg.type) {
+        case Arg::Type::kInt:
+            snprintf(buf, sizeof(buf), "%" PRId64, arg.value);
+            out += buf;
+            break;
+        case Arg::Type::kUnsigned:
+            snprintf(buf, sizeof(buf), "%" PRIu64, (uint64_t) arg.value);
+            out += buf;
+            break;
+        case Arg::Type::kString:
+            out += arg.text;
+            break;
+        case Arg::Type::kQuotedString:
+            out += '"';
+            out += arg.text;
+            out += '"';
+            break;
+        }
+    }
+    return out;
+}
+
+}  // namespace droidvold
+}  // namespace android
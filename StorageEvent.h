@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_STORAGE_EVENT_H
+#define ANDROID_VOLD_STORAGE_EVENT_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * One broadcast as typed fields: a ResponseCode, the disk, volume or job
+ * it concerns, and its arguments in order. Events travel through the
+ * dispatch queues in this form and are only rendered as the legacy
+ * "id arg arg" text when handed to a callback that still expects it.
+ */
+class StorageEvent {
+public:
+    struct Arg {
+        enum class Type {
+            kInt,
+            kUnsigned,
+            kString,
+            /* Rendered in double quotes, may be empty */
+            kQuotedString,
+        };
+
+        Type type;
+        int64_t value;
+        std::string text;
+    };
+
+    StorageEvent() : mCode(0), mSeq(0) {}
+    StorageEvent(int code, const std::string& id) : mCode(code), mId(id), mSeq(0) {}
+
+    StorageEvent& add(int64_t value);
+    StorageEvent& addUnsigned(uint64_t value);
+    StorageEvent& add(const std::string& text);
+    StorageEvent& addQuoted(const std::string& text);
+
+    int getCode() const { return mCode; }
+    const std::string& getId() const { return mId; }
+    void setId(const std::string& id) { mId = id; }
+    /* Position in the broadcast stream, assigned when the event is sent */
+    uint64_t getSeq() const { return mSeq; }
+    void setSeq(uint64_t seq) { mSeq = seq; }
+    const std::vector<Arg>& getArgs() const { return mArgs; }
+
+    /* The message as callbacks have always received it */
+    std::string toString() const;
+
+private:
+    int mCode;
+    std::string mId;
+    uint64_t mSeq;
+    std::vector<Arg> mArgs;
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StorageState.h"
+#include "ResponseCode.h"
+
+#include <utils/Timers.h>
+
+namespace android {
+namespace droidvold {
+
+StorageState::StorageState(size_t historyDepth) :
+        mHistoryDepth(historyDepth), mSequence(systemTime(SYSTEM_TIME_BOOTTIME)) {
+}
+
+static int64_t intArg(const StorageEvent& event, size_t i) {
+    auto& args = event.getArgs();
+    return i < args.size() ? args[i].value : 0;
+}
+
+static std::string stringArg(const StorageEvent& event, size_t i) {
+    auto& args = event.getArgs();
+    return i < args.size() ? args[i].text : "";
+}
+
+void StorageState::apply(const StorageEvent& event) {
+    const std::string& id = event.getId();
+
+    switch (event.getCode()) {
+    case ResponseCode::DiskCreated: {
+        Disk& disk = mDisks[id];
+        disk = Disk();
+        disk.id = id;
+        disk.flags = intArg(event, 0);
+        disk.size = 0;
+        return;
+    }
+    case ResponseCode::DiskDestroyed:
+        mDisks.erase(id);
+        return;
+    case ResponseCode::VolumeCreated: {
+        Volume& vol = mVolumes[id];
+        vol = Volume();
+        vol.id = id;
+        vol.type = intArg(event, 0);
+        vol.diskId = stringArg(event, 1);
+        vol.partGuid = stringArg(event, 2);
+        vol.state = 0;
+        return;
+    }
+    case ResponseCode::VolumeDestroyed:
+        mVolumes.erase(id);
+        return;
+    }
+
+    auto disk = mDisks.find(id);
+    if (disk != mDisks.end()) {
+        switch (event.getCode()) {
+        case ResponseCode::DiskSizeChanged:
+            disk->second.size = intArg(event, 0);
+            break;
+        case ResponseCode::DiskLabelChanged:
+            disk->second.label = stringArg(event, 0);
+            break;
+        case ResponseCode::DiskSysPathChanged:
+            disk->second.sysPath = stringArg(event, 0);
+            break;
+        }
+        return;
+    }
+
+    auto vol = mVolumes.find(id);
+    if (vol != mVolumes.end()) {
+        switch (event.getCode()) {
+        case ResponseCode::VolumeStateChanged:
+            vol->second.state = intArg(event, 0);
+            break;
+        case ResponseCode::VolumeFsTypeChanged:
+            vol->second.fsType = stringArg(event, 0);
+            break;
+        case ResponseCode::VolumeFsUuidChanged:
+            vol->second.fsUuid = stringArg(event, 0);
+            break;
+        case ResponseCode::VolumeFsLabelChanged:
+            vol->second.fsLabel = stringArg(event, 0);
+            break;
+        case ResponseCode::VolumePathChanged:
+            vol->second.path = stringArg(event, 0);
+            break;
+        case ResponseCode::VolumeInternalPathChanged:
+            vol->second.internalPath = stringArg(event, 0);
+            break;
+        }
+    }
+}
+
+void StorageState::record(StorageEvent& event) {
+    std::lock_guard<std::mutex> lock(mLock);
+    event.setSeq(++mSequence);
+    apply(event);
+
+    if (mHistory.size() == mHistoryDepth) {
+        mHistory.pop_front();
+    }
+    mHistory.push_back(event);
+}
+
+uint64_t StorageState::getSequence() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mSequence;
+}
+
+bool StorageState::getEventsSince(uint64_t lastSeq, std::vector<StorageEvent>& events) {
+    std::lock_guard<std::mutex> lock(mLock);
+    uint64_t oldest = mHistory.empty() ? mSequence + 1 : mHistory.front().getSeq();
+    if (lastSeq > mSequence || lastSeq + 1 < oldest) {
+        return false;
+    }
+
+    events.clear();
+    events.insert(events.end(), mHistory.end() - (mSequence - lastSeq), mHistory.end());
+    return true;
+}
+
+void StorageState::addDiskEvents(const Disk& disk, std::vector<StorageEvent>& events) {
+    events.push_back(StorageEvent(ResponseCode::DiskCreated, disk.id).add(disk.flags));
+    events.push_back(StorageEvent(ResponseCode::DiskSizeChanged, disk.id)
+            .addUnsigned(disk.size));
+    events.push_back(StorageEvent(ResponseCode::DiskLabelChanged, disk.id).add(disk.label));
+    events.push_back(StorageEvent(ResponseCode::DiskSysPathChanged, disk.id)
+            .add(disk.sysPath));
+    for (auto& vol : mVolumes) {
+        if (vol.second.diskId == disk.id) {
+            addVolumeEvents(vol.second, events);
+        }
+    }
+    events.push_back(StorageEvent(ResponseCode::DiskScanned, disk.id));
+}
+
+void StorageState::addVolumeEvents(const Volume& vol, std::vector<StorageEvent>& events) {
+    events.push_back(StorageEvent(ResponseCode::VolumeCreated, vol.id)
+            .add(vol.type).addQuoted(vol.diskId).addQuoted(vol.partGuid));
+    events.push_back(StorageEvent(ResponseCode::VolumeFsTypeChanged, vol.id).add(vol.fsType));
+    events.push_back(StorageEvent(ResponseCode::VolumeFsUuidChanged, vol.id).add(vol.fsUuid));
+    events.push_back(StorageEvent(ResponseCode::VolumeFsLabelChanged, vol.id)
+            .add(vol.fsLabel));
+    events.push_back(StorageEvent(ResponseCode::VolumePathChanged, vol.id).add(vol.path));
+    events.push_back(StorageEvent(ResponseCode::VolumeInternalPathChanged, vol.id)
+            .add(vol.internalPath));
+    // Last, clients act on the state with the fields above in place
+    events.push_back(StorageEvent(ResponseCode::VolumeStateChanged, vol.id).add(vol.state));
+}
+
+void StorageState::getSnapshotEvents(std::vector<StorageEvent>& events) {
+    std::lock_guard<std::mutex> lock(mLock);
+    events.clear();
+    events.push_back(StorageEvent(ResponseCode::StateSnapshot, "").addUnsigned(mSequence));
+    for (auto& disk : mDisks) {
+        addDiskEvents(disk.second, events);
+    }
+    for (auto& vol : mVolumes) {
+        if (!mDisks.count(vol.second.diskId)) {
+            addVolumeEvents(vol.second, events);
+        }
+    }
+    for (auto& event : events) {
+        event.setSeq(mSequence);
+    }
+}
+
+uint64_t StorageState::getState(std::vector<Disk>& disks, std::vector<Volume>& volumes) {
+    std::lock_guard<std::mutex> lock(mLock);
+    disks.clear();
+    disks.reserve(mDisks.size());
+    for (auto& disk : mDisks) {
+        disks.push_back(disk.second);
+    }
+    volumes.clear();
+    volumes.reserve(mVolumes.size());
+    for (auto& vol : mVolumes) {
+        volumes.push_back(vol.second);
+    }
+    return mSequence;
+}
+
+}  // namespace droidvold
+}  // namespace android
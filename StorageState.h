@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_STORAGE_STATE_H
+#define ANDROID_VOLD_STORAGE_STATE_H
+
+#include "StorageEvent.h"
+#include "Utils.h"
+
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Current disk and volume table, folded from the same events that are
+ * broadcast. A (re)connecting client can fetch it in one call instead of
+ * forcing reset(), and it always agrees with what the event stream has
+ * told clients so far.
+ *
+ * Every recorded event is stamped with the next sequence number and kept
+ * in a bounded history, so a client that knows the last sequence it saw
+ * can be sent just what it missed. Numbering starts from the boot clock,
+ * which keeps sequences from an earlier droidvold run below anything the
+ * history holds.
+ */
+class StorageState {
+public:
+    struct Disk {
+        std::string id;
+        int flags;
+        uint64_t size;
+        std::string label;
+        std::string sysPath;
+    };
+
+    struct Volume {
+        std::string id;
+        int type;
+        std::string diskId;
+        std::string partGuid;
+        int state;
+        std::string fsType;
+        std::string fsUuid;
+        std::string fsLabel;
+        std::string path;
+        std::string internalPath;
+    };
+
+    explicit StorageState(size_t historyDepth);
+
+    /* Stamps the event, updates the table and keeps it in the history */
+    void record(StorageEvent& event);
+    /* Returns the sequence number the table reflects */
+    uint64_t getState(std::vector<Disk>& disks, std::vector<Volume>& volumes);
+    uint64_t getSequence();
+
+    /*
+     * Events after lastSeq, in order. Fails if some of them have already
+     * left the history, or lastSeq wasn't issued by this run.
+     */
+    bool getEventsSince(uint64_t lastSeq, std::vector<StorageEvent>& events);
+    /*
+     * A StateSnapshot marker followed by the events that recreate the
+     * current table, all stamped with the current sequence number.
+     */
+    void getSnapshotEvents(std::vector<StorageEvent>& events);
+
+private:
+    /* Called with mLock held */
+    void apply(const StorageEvent& event);
+    void addDiskEvents(const Disk& disk, std::vector<StorageEvent>& events);
+    void addVolumeEvents(const Volume& vol, std::vector<StorageEvent>& events);
+
+    std::mutex mLock;
+    size_t mHistoryDepth;
+    uint64_t mSequence;
+    std::deque<StorageEvent> mHistory;
+    /* By ID, so replies list objects in a stable order */
+    std::map<std::string, Disk> mDisks;
+    std::map<std::string, Volume> mVolumes;
+
+    DISALLOW_COPY_AND_ASSIGN(StorageState);
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UeventCoalescer.h"
+
+#include <android-base/logging.h>
+
+#include <algorithm>
+
+namespace android {
+namespace droidvold {
+
+/* A burst that never goes quiet is still flushed after this many windows */
+static const int kMaxHoldWindows = 4;
+
+typedef NetlinkEvent::Action Action;
+
+UeventCoalescer::UeventCoalescer(const Sink& sink, std::chrono::milliseconds window) :
+        mSink(sink), mWindow(window), mNextSeq(0), mStopping(false), mCollapsed(0),
+        mForwarded(0) {
+}
+
+UeventCoalescer::~UeventCoalescer() {
+    stop();
+}
+
+void UeventCoalescer::start() {
+    if (mWindow.count() > 0 && !mThread.joinable()) {
+        mStopping = false;
+        mThread = std::thread(&UeventCoalescer::run, this);
+    }
+}
+
+void UeventCoalescer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopping = true;
+    }
+    mCond.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void UeventCoalescer::merge(std::vector<Entry>& pending, const Entry& entry) {
+    if (pending.empty()) {
+        pending.push_back(entry);
+        return;
+    }
+
+    Entry& last = pending.back();
+    Action lastAction = last.evt->getAction();
+    Action action = entry.evt->getAction();
+
+    if (lastAction == Action::kAdd) {
+        switch (action) {
+        case Action::kAdd:
+            // Newer add wins, it carries the current attributes
+            last = entry;
+            mCollapsed++;
+            return;
+        case Action::kChange:
+            // The add will read fresh metadata anyway
+            mCollapsed++;
+            return;
+        case Action::kRemove:
+            // Device came and went before we acted on it
+            pending.pop_back();
+            mCollapsed += 2;
+            return;
+        default:
+            break;
+        }
+    } else if (lastAction == Action::kChange) {
+        switch (action) {
+        case Action::kChange:
+            mCollapsed++;
+            return;
+        case Action::kRemove:
+            last = entry;
+            mCollapsed++;
+            return;
+        default:
+            break;
+        }
+    } else if (lastAction == Action::kRemove) {
+        if (action == Action::kRemove) {
+            mCollapsed++;
+            return;
+        }
+    }
+
+    pending.push_back(entry);
+}
+
+UeventCoalescer::Batch UeventCoalescer::takePendingLocked() {
+    std::vector<Entry> entries;
+    for (auto& pending : mPending) {
+        entries.insert(entries.end(), pending.second.begin(), pending.second.end());
+    }
+    mPending.clear();
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.seq < b.seq;
+    });
+
+    Batch batch;
+    batch.reserve(entries.size());
+    for (auto& entry : entries) {
+        batch.push_back(entry.evt);
+    }
+    mForwarded += batch.size();
+    return batch;
+}
+
+void UeventCoalescer::submit(const Batch& events) {
+    if (!mThread.joinable()) {
+        mForwarded += events.size();
+        mSink(events);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto now = std::chrono::steady_clock::now();
+        if (mPending.empty()) {
+            mFirstPending = now;
+        }
+        mLastPending = now;
+
+        for (auto& evt : events) {
+            const char* devPath = evt->findParam("DEVPATH");
+            Entry entry = { mNextSeq++, evt };
+            merge(mPending[devPath ? devPath : ""], entry);
+        }
+    }
+    mCond.notify_all();
+}
+
+void UeventCoalescer::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (!mStopping) {
+        if (mPending.empty()) {
+            mCond.wait(lock);
+            continue;
+        }
+
+        auto deadline = std::min(mLastPending + mWindow,
+                mFirstPending + mWindow * kMaxHoldWindows);
+        if (std::chrono::steady_clock::now() < deadline) {
+            mCond.wait_until(lock, deadline);
+            continue;
+        }
+
+        Batch batch = takePendingLocked();
+        lock.unlock();
+        if (!batch.empty()) {
+            mSink(batch);
+        }
+        lock.lock();
+    }
+
+    // Don't lose whatever was still held back
+    Batch batch = takePendingLocked();
+    lock.unlock();
+    if (!batch.empty()) {
+        mSink(batch);
+    }
+}
+
+}  // namespace droidvold
+}  // namespace android
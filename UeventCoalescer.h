@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_UEVENT_COALESCER_H
+#define ANDROID_VOLD_UEVENT_COALESCER_H
+
+#include "Utils.h"
+
+#include <sysutils/NetlinkEvent.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * Holds block uevents for a short quiet window and collapses bursts for
+ * the same DEVPATH before they reach VolumeManager:
+ *
+ *   add + remove     -> nothing
+ *   add + change     -> add
+ *   change + change  -> change
+ *   change + remove  -> remove
+ *   remove + add     -> kept, the media may have been swapped
+ *
+ * Surviving events are delivered in their original arrival order. A zero
+ * window disables coalescing and forwards batches untouched.
+ */
+class UeventCoalescer {
+public:
+    typedef std::vector<std::shared_ptr<NetlinkEvent>> Batch;
+    typedef std::function<void(const Batch&)> Sink;
+
+    UeventCoalescer(const Sink& sink, std::chrono::milliseconds window);
+    ~UeventCoalescer();
+
+    void start();
+    void stop();
+
+    void submit(const Batch& events);
+
+    /* Events dropped because a later event made them redundant */
+    uint64_t getCollapsedCount() { return mCollapsed; }
+    /* Events forwarded to the sink */
+    uint64_t getForwardedCount() { return mForwarded; }
+
+private:
+    struct Entry {
+        uint64_t seq;
+        std::shared_ptr<NetlinkEvent> evt;
+    };
+
+    Sink mSink;
+    std::chrono::milliseconds mWindow;
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    /* Pending events by DEVPATH, oldest first */
+    std::unordered_map<std::string, std::vector<Entry>> mPending;
+    uint64_t mNextSeq;
+    std::chrono::steady_clock::time_point mFirstPending;
+    std::chrono::steady_clock::time_point mLastPending;
+    bool mStopping;
+    std::thread mThread;
+
+    std::atomic<uint64_t> mCollapsed;
+    std::atomic<uint64_t> mForwarded;
+
+    void merge(std::vector<Entry>& pending, const Entry& entry);
+    Batch takePendingLocked();
+    void run();
+
+    DISALLOW_COPY_AND_ASSIGN(UeventCoalescer);
+};
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UeventRecorder.h"
+#include "VolumeManager.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <thread>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <sysutils/NetlinkListener.h>
+
+using android::base::StringPrintf;
+
+#ifdef REPLAY_COUNT_ALLOCATIONS
+static thread_local uint64_t sThreadAllocations;
+
+// Only in droidvold_replay, so the harness can report allocations per
+// event; the daemon itself keeps the default allocator.
+void* operator new(size_t size) {
+    sThreadAllocations++;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        abort();
+    }
+    return ptr;
+}
+#endif
+
+namespace android {
+namespace droidvold {
+
+static const char kMagic[4] = { 'D', 'V', 'U', 'E' };
+static const uint32_t kVersion = 1;
+
+static const char* actionToString(NetlinkEvent::Action action) {
+    switch (action) {
+    case NetlinkEvent::Action::kAdd: return "add";
+    case NetlinkEvent::Action::kRemove: return "remove";
+    case NetlinkEvent::Action::kChange: return "change";
+    default: return nullptr;
+    }
+}
+
+static std::string findParam(NetlinkEvent *evt, const char* name) {
+    const char* value = evt->findParam(name);
+    return value ? value : "";
+}
+
+static int findIntParam(NetlinkEvent *evt, const char* name) {
+    const char* value = evt->findParam(name);
+    return value ? atoi(value) : -1;
+}
+
+UeventRecord::UeventRecord() :
+        timestamp(0), action(NetlinkEvent::Action::kUnknown), devMajor(-1), devMinor(-1),
+        partN(-1) {
+}
+
+UeventRecord UeventRecord::fromNetlinkEvent(NetlinkEvent *evt, nsecs_t timestamp) {
+    UeventRecord rec;
+    rec.timestamp = timestamp;
+    rec.action = evt->getAction();
+    rec.devPath = findParam(evt, "DEVPATH");
+    rec.devType = findParam(evt, "DEVTYPE");
+    rec.devName = findParam(evt, "DEVNAME");
+    rec.devMajor = findIntParam(evt, "MAJOR");
+    rec.devMinor = findIntParam(evt, "MINOR");
+    rec.partN = findIntParam(evt, "PARTN");
+    return rec;
+}
+
+std::unique_ptr<NetlinkEvent> UeventRecord::toNetlinkEvent() const {
+    const char* act = actionToString(action);
+    if (act == nullptr) {
+        return nullptr;
+    }
+
+    // Same layout as kobject_uevent_env(): header, then NUL separated keys
+    std::string buf = StringPrintf("%s@%s", act, devPath.c_str());
+    buf.push_back('\0');
+    buf += StringPrintf("ACTION=%s", act);
+    buf.push_back('\0');
+    buf += StringPrintf("DEVPATH=%s", devPath.c_str());
+    buf.push_back('\0');
+    buf += "SUBSYSTEM=block";
+    buf.push_back('\0');
+    if (devMajor >= 0) {
+        buf += StringPrintf("MAJOR=%d", devMajor);
+        buf.push_back('\0');
+    }
+    if (devMinor >= 0) {
+        buf += StringPrintf("MINOR=%d", devMinor);
+        buf.push_back('\0');
+    }
+    buf += StringPrintf("DEVNAME=%s", devName.c_str());
+    buf.push_back('\0');
+    buf += StringPrintf("DEVTYPE=%s", devType.c_str());
+    buf.push_back('\0');
+    if (partN >= 0) {
+        buf += StringPrintf("PARTN=%d", partN);
+        buf.push_back('\0');
+    }
+
+    std::unique_ptr<NetlinkEvent> evt(new NetlinkEvent());
+    if (!evt->decode(&buf[0], buf.size(), NetlinkListener::NETLINK_FORMAT_ASCII)) {
+        LOG(WARNING) << "Failed to rebuild uevent for " << devPath;
+        return nullptr;
+    }
+    return evt;
+}
+
+static void writeString(FILE* fp, const std::string& str) {
+    uint16_t len = std::min(str.size(), (size_t) UINT16_MAX);
+    fwrite(&len, sizeof(len), 1, fp);
+    fwrite(str.data(), 1, len, fp);
+}
+
+static bool readString(FILE* fp, std::string& str) {
+    uint16_t len;
+    if (fread(&len, sizeof(len), 1, fp) != 1) {
+        return false;
+    }
+    str.resize(len);
+    return len == 0 || fread(&str[0], 1, len, fp) == len;
+}
+
+UeventRecorder::UeventRecorder() : mFile(nullptr) {
+}
+
+UeventRecorder::~UeventRecorder() {
+    close();
+}
+
+status_t UeventRecorder::open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFile != nullptr) {
+        return -EBUSY;
+    }
+
+    mFile = fopen(path.c_str(), "we");
+    if (mFile == nullptr) {
+        PLOG(ERROR) << "Failed to open uevent record " << path;
+        return -errno;
+    }
+
+    fwrite(kMagic, sizeof(kMagic), 1, mFile);
+    fwrite(&kVersion, sizeof(kVersion), 1, mFile);
+    LOG(INFO) << "Recording block uevents to " << path;
+    return OK;
+}
+
+void UeventRecorder::close() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFile != nullptr) {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+}
+
+void UeventRecorder::record(NetlinkEvent *evt, nsecs_t timestamp) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFile == nullptr) {
+        return;
+    }
+
+    UeventRecord rec = UeventRecord::fromNetlinkEvent(evt, timestamp);
+    int64_t ts = rec.timestamp;
+    uint8_t action = (uint8_t) rec.action;
+    int32_t ints[3] = { rec.devMajor, rec.devMinor, rec.partN };
+
+    fwrite(&ts, sizeof(ts), 1, mFile);
+    fwrite(&action, sizeof(action), 1, mFile);
+    fwrite(ints, sizeof(ints), 1, mFile);
+    writeString(mFile, rec.devPath);
+    writeString(mFile, rec.devType);
+    writeString(mFile, rec.devName);
+}
+
+void UeventRecorder::flush() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFile != nullptr) {
+        fflush(mFile);
+    }
+}
+
+status_t ReadUeventRecords(const std::string& path, std::vector<UeventRecord>& records) {
+    records.clear();
+
+    std::unique_ptr<FILE, int(*)(FILE*)> fp(fopen(path.c_str(), "re"), fclose);
+    if (!fp) {
+        PLOG(ERROR) << "Failed to open uevent record " << path;
+        return -errno;
+    }
+
+    char magic[4];
+    uint32_t version;
+    if (fread(magic, sizeof(magic), 1, fp.get()) != 1
+            || memcmp(magic, kMagic, sizeof(kMagic))
+            || fread(&version, sizeof(version), 1, fp.get()) != 1
+            || version != kVersion) {
+        LOG(ERROR) << path << " is not a uevent record";
+        return -EINVAL;
+    }
+
+    while (true) {
+        UeventRecord rec;
+        int64_t ts;
+        uint8_t action;
+        int32_t ints[3];
+
+        if (fread(&ts, sizeof(ts), 1, fp.get()) != 1) {
+            break;
+        }
+        if (fread(&action, sizeof(action), 1, fp.get()) != 1
+                || fread(ints, sizeof(ints), 1, fp.get()) != 1
+                || !readString(fp.get(), rec.devPath)
+                || !readString(fp.get(), rec.devType)
+                || !readString(fp.get(), rec.devName)) {
+            LOG(WARNING) << path << " is truncated after " << records.size() << " records";
+            break;
+        }
+
+        rec.timestamp = ts;
+        rec.action = (NetlinkEvent::Action) action;
+        rec.devMajor = ints[0];
+        rec.devMinor = ints[1];
+        rec.partN = ints[2];
+        records.push_back(rec);
+    }
+
+    return OK;
+}
+
+// Checks whether name is disk itself or one of its partitions ("sda1",
+// "mmcblk0p1"), leaving the partition number (or nothing) in suffix
+static bool partitionSuffix(const std::string& name, const std::string& disk,
+        std::string& suffix) {
+    if (name.compare(0, disk.size(), disk)) {
+        return false;
+    }
+    suffix = name.substr(disk.size());
+    size_t digits = (!suffix.empty() && suffix[0] == 'p') ? 1 : 0;
+    if (digits == suffix.size()) {
+        return suffix.empty();
+    }
+    for (size_t i = digits; i < suffix.size(); i++) {
+        if (!isdigit(suffix[i])) {
+            return false;
+        }
+    }
+    suffix = suffix.substr(digits);
+    return true;
+}
+
+void RemapUeventRecords(std::vector<UeventRecord>& records,
+        const std::map<std::string, std::string>& devNames) {
+    for (auto& rec : records) {
+        for (auto& entry : devNames) {
+            std::string suffix;
+            if (!partitionSuffix(rec.devName, entry.first, suffix)) {
+                continue;
+            }
+
+            const std::string& to = entry.second;
+            std::string name = to;
+            if (!suffix.empty()) {
+                // mmcblk0 and loop0 style disks put a "p" before the number
+                name += (isdigit(to.back()) ? "p" : "") + suffix;
+            }
+            rec.devName = name;
+
+            char link[PATH_MAX];
+            std::string classPath = StringPrintf("/sys/class/block/%s", name.c_str());
+            ssize_t len = readlink(classPath.c_str(), link, sizeof(link) - 1);
+            if (len > 0) {
+                link[len] = '\0';
+                const char* devPath = strstr(link, "/devices/");
+                if (devPath != nullptr) {
+                    rec.devPath = devPath;
+                }
+            }
+
+            struct stat sb;
+            std::string blockPath = StringPrintf("/dev/block/%s", name.c_str());
+            if (!stat(blockPath.c_str(), &sb) && S_ISBLK(sb.st_mode)) {
+                rec.devMajor = major(sb.st_rdev);
+                rec.devMinor = minor(sb.st_rdev);
+            }
+            break;
+        }
+    }
+}
+
+// Looks up every known volume ID over and over until told to stop
+static void lookupLoop(std::atomic<bool>* stop, std::atomic<uint64_t>* lookups,
+        std::atomic<nsecs_t>* maxLatency) {
+    VolumeManager* vm = VolumeManager::Instance();
+    uint64_t count = 0;
+    nsecs_t worst = 0;
+
+    while (!*stop) {
+        std::list<std::string> ids;
+        vm->listVolumes(VolumeBase::Type::kPublic, ids);
+        // Misses cost as much as hits, keep looking while nothing exists
+        ids.push_back("public:0,0");
+        for (auto& id : ids) {
+            nsecs_t before = systemTime(SYSTEM_TIME_MONOTONIC);
+            vm->findVolume(id);
+            worst = std::max(worst, systemTime(SYSTEM_TIME_MONOTONIC) - before);
+            count++;
+        }
+    }
+
+    *lookups += count;
+    nsecs_t current = *maxLatency;
+    while (worst > current && !maxLatency->compare_exchange_weak(current, worst)) {
+    }
+}
+
+status_t ReplayUevents(const std::vector<UeventRecord>& records, double speed,
+        int lookupThreads, ReplayStats& stats) {
+    VolumeManager* vm = VolumeManager::Instance();
+
+    stats.events = 0;
+    stats.routingLatencies.clear();
+    stats.allocations = 0;
+    stats.timeToSettled = 0;
+    stats.lookups = 0;
+    stats.maxLookupLatency = 0;
+    if (records.empty()) {
+        return OK;
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> lookups(0);
+    std::atomic<nsecs_t> maxLatency(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < lookupThreads; i++) {
+        threads.emplace_back(lookupLoop, &stop, &lookups, &maxLatency);
+    }
+
+    nsecs_t base = records.front().timestamp;
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (auto& rec : records) {
+        if (speed > 0) {
+            nsecs_t due = start + (nsecs_t) ((rec.timestamp - base) / speed);
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (due > now) {
+                usleep((due - now) / 1000);
+            }
+        }
+
+        std::shared_ptr<NetlinkEvent> evt = rec.toNetlinkEvent();
+        if (evt == nullptr) {
+            continue;
+        }
+
+        uint64_t allocations = GetThreadAllocationCount();
+        nsecs_t before = systemTime(SYSTEM_TIME_MONOTONIC);
+        vm->handleBlockEvent(evt);
+        nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - before;
+        stats.allocations += GetThreadAllocationCount() - allocations;
+        stats.routingLatencies.push_back(latency);
+        stats.events++;
+    }
+    vm->waitForIdle();
+    stats.timeToSettled = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    stats.lookups = lookups;
+    stats.maxLookupLatency = maxLatency;
+
+    return OK;
+}
+
+uint64_t GetThreadAllocationCount() {
+#ifdef REPLAY_COUNT_ALLOCATIONS
+    return sThreadAllocations;
+#else
+    return 0;
+#endif
+}
+
+void DumpReplayStats(const ReplayStats& stats, FILE* out) {
+    fprintf(out, "events: %zu\n", stats.events);
+    fprintf(out, "time to settled: %.3f ms\n", stats.timeToSettled / 1e6);
+    if (stats.lookups > 0) {
+        fprintf(out, "lookups: %" PRIu64 " (%.0f per second, max %.1f us)\n", stats.lookups,
+                stats.lookups / (stats.timeToSettled / 1e9), stats.maxLookupLatency / 1e3);
+    }
+    if (stats.routingLatencies.empty()) {
+        return;
+    }
+#ifdef REPLAY_COUNT_ALLOCATIONS
+    fprintf(out, "routing allocations: %" PRIu64 " (%.2f per event)\n", stats.allocations,
+            (double) stats.allocations / stats.events);
+#else
+    fprintf(out, "routing allocations: not counted, replay with droidvold_replay\n");
+#endif
+
+    std::vector<nsecs_t> sorted(stats.routingLatencies);
+    std::sort(sorted.begin(), sorted.end());
+    nsecs_t total = 0;
+    for (auto latency : sorted) {
+        total += latency;
+    }
+
+    auto percentile = [&sorted](int p) {
+        return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)] / 1e3;
+    };
+    fprintf(out, "routing latency us: min %.1f avg %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+            sorted.front() / 1e3, total / 1e3 / sorted.size(), percentile(50),
+            percentile(90), percentile(99), sorted.back() / 1e3);
+}
+
+}  // namespace droidvold
+}  // namespace android
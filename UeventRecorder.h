@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_UEVENT_RECORDER_H
+#define ANDROID_VOLD_UEVENT_RECORDER_H
+
+#include "Utils.h"
+
+#include <sysutils/NetlinkEvent.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <stdio.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace droidvold {
+
+/*
+ * One block uevent, reduced to the fields droidvold acts on.
+ */
+struct UeventRecord {
+    /* Monotonic receive time */
+    nsecs_t timestamp;
+    NetlinkEvent::Action action;
+    std::string devPath;
+    std::string devType;
+    std::string devName;
+    int devMajor;
+    int devMinor;
+    int partN;
+
+    UeventRecord();
+
+    /* Captures the interesting parameters of a decoded event */
+    static UeventRecord fromNetlinkEvent(NetlinkEvent *evt, nsecs_t timestamp);
+
+    /* Rebuilds the event the kernel would have sent for this record */
+    std::unique_ptr<NetlinkEvent> toNetlinkEvent() const;
+};
+
+/*
+ * Appends block uevents to a compact binary file so that plug storms seen
+ * in the field can be replayed offline with ReplayUevents().
+ */
+class UeventRecorder {
+public:
+    UeventRecorder();
+    ~UeventRecorder();
+
+    status_t open(const std::string& path);
+    void close();
+    bool isOpen() { return mFile != nullptr; }
+
+    void record(NetlinkEvent *evt, nsecs_t timestamp);
+    void flush();
+
+private:
+    std::mutex mLock;
+    FILE* mFile;
+
+    DISALLOW_COPY_AND_ASSIGN(UeventRecorder);
+};
+
+status_t ReadUeventRecords(const std::string& path, std::vector<UeventRecord>& records);
+
+/*
+ * Redirects recorded disks onto local devices, e.g. "sda" -> "loop0". The
+ * disk and all of its partitions are renamed, and DEVPATH, MAJOR and MINOR
+ * are refreshed from sysfs and /dev/block when the target exists.
+ */
+void RemapUeventRecords(std::vector<UeventRecord>& records,
+        const std::map<std::string, std::string>& devNames);
+
+struct ReplayStats {
+    size_t events;
+    /*
+     * Time spent routing each event in VolumeManager::handleBlockEvent(),
+     * which only queues the work on a disk worker; timeToSettled covers
+     * the handling itself
+     */
+    std::vector<nsecs_t> routingLatencies;
+    /*
+     * Heap allocations made while routing, on the replaying thread. Only
+     * counted by droidvold_replay.
+     */
+    uint64_t allocations;
+    /* From first dispatch until every disk worker went idle */
+    nsecs_t timeToSettled;
+    /* findVolume() calls made by the lookup threads during the replay */
+    uint64_t lookups;
+    nsecs_t maxLookupLatency;
+};
+
+/*
+ * Feeds records back through VolumeManager::handleBlockEvent(). A speed of
+ * 1.0 keeps the recorded spacing, 2.0 halves it and 0 replays back to back.
+ * Meanwhile lookupThreads threads call findVolume() in a loop, the way
+ * HIDL clients would during a plug storm.
+ */
+status_t ReplayUevents(const std::vector<UeventRecord>& records, double speed,
+        int lookupThreads, ReplayStats& stats);
+
+void DumpReplayStats(const ReplayStats& stats, FILE* out);
+
+/* operator new calls made so far by the calling thread, 0 outside droidvold_replay */
+uint64_t GetThreadAllocationCount();
+
+}  // namespace droidvold
+}  // namespace android
+
+#endif
@@ -15,6 +15,8 @@
  */
 
 #include "Utils.h"
+#include "BlockTopology.h"
+#include "FsProbe.h"
 #include "Process.h"
 
 #include <android-base/file.h>
@@ -56,7 +58,6 @@ namespace droidvold {
 
 security_context_t sBlkidUntrustedContext = nullptr;
 
-static const char* kBlkidPath = "/system/bin/blkid";
 static const char* kKeyPath = "/data/misc/vold";
 
 static const char* kProcFilesystems = "/proc/filesystems";
@@ -72,6 +73,35 @@ status_t PrepareDir(const std::string& path, mode_t mode, uid_t uid, gid_t gid)
     }
 }
 
+static thread_local nsecs_t sUnmountDeadline = 0;
+
+void SetUnmountDeadline(nsecs_t deadline) {
+    sUnmountDeadline = deadline;
+}
+
+// Sleeps unless that would run past the thread's unmount deadline
+static bool sleepBeforeDeadline(unsigned int seconds) {
+    if (sUnmountDeadline > 0 && systemTime(SYSTEM_TIME_MONOTONIC)
+            + seconds_to_nanoseconds(seconds) > sUnmountDeadline) {
+        return false;
+    }
+    sleep(seconds);
+    return true;
+}
+
+static status_t detachUnmount(const char* cpath) {
+    LOG(WARNING) << "Unmount deadline reached, lazily detaching " << cpath;
+    int fd = open(cpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        syncfs(fd);
+        close(fd);
+    }
+    if (!umount2(cpath, UMOUNT_NOFOLLOW | MNT_DETACH) || errno == EINVAL || errno == ENOENT) {
+        return OK;
+    }
+    return -errno;
+}
+
 status_t ForceUnmount(const std::string& path) {
     const char* cpath = path.c_str();
     if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
@@ -79,22 +109,30 @@ status_t ForceUnmount(const std::string& path) {
     }
     // Apps might still be handling eject request, so wait before
     // we start sending signals
-    sleep(5);
+    if (!sleepBeforeDeadline(5)) {
+        return detachUnmount(cpath);
+    }
 
     Process::killProcessesWithOpenFiles(cpath, SIGINT);
-    sleep(5);
+    if (!sleepBeforeDeadline(5)) {
+        return detachUnmount(cpath);
+    }
     if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
         return OK;
     }
 
     Process::killProcessesWithOpenFiles(cpath, SIGTERM);
-    sleep(5);
+    if (!sleepBeforeDeadline(5)) {
+        return detachUnmount(cpath);
+    }
     if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
         return OK;
     }
 
     Process::killProcessesWithOpenFiles(cpath, SIGKILL);
-    sleep(5);
+    if (!sleepBeforeDeadline(5)) {
+        return detachUnmount(cpath);
+    }
     if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
         return OK;
     }
@@ -107,17 +145,23 @@ status_t KillProcessesUsingPath(const std::string& path) {
     if (Process::killProcessesWithOpenFiles(cpath, SIGINT) == 0) {
         return OK;
     }
-    sleep(5);
+    if (!sleepBeforeDeadline(5)) {
+        return -ETIMEDOUT;
+    }
 
     if (Process::killProcessesWithOpenFiles(cpath, SIGTERM) == 0) {
         return OK;
     }
-    sleep(5);
+    if (!sleepBeforeDeadline(5)) {
+        return -ETIMEDOUT;
+    }
 
     if (Process::killProcessesWithOpenFiles(cpath, SIGKILL) == 0) {
         return OK;
     }
-    sleep(5);
+    if (!sleepBeforeDeadline(5)) {
+        return -ETIMEDOUT;
+    }
 
     // Send SIGKILL a second time to determine if we've
     // actually killed everyone with open files
@@ -136,17 +180,21 @@ status_t BindMount(const std::string& source, const std::string& target) {
     return OK;
 }
 
-status_t ReadPartMetadata(const std::string& path, std::string& fsType,
+// Filesystems the native prober doesn't know about
+static status_t readBlkidMetadata(const std::string& path, std::string& fsType,
         std::string& fsUuid, std::string& fsLabel) {
     blkid_cache cache = NULL;
     const char *devices = path.c_str();
 
     if (blkid_get_cache(&cache, "/dev/null") < 0) {
+        status_t res = -errno;
         PLOG(ERROR) << "blkid get cache failed path=" << path;
         blkid_put_cache(cache);
-        return  -errno;
+        return res;
     }
 
+    // The native prober just read the device, so no result means no
+    // filesystem blkid knows either
     blkid_dev dev = blkid_get_dev(cache, devices, BLKID_DEV_NORMAL);
     if (dev) {
         blkid_tag_iterate iter;
@@ -166,10 +214,56 @@ status_t ReadPartMetadata(const std::string& path, std::string& fsType,
         }
         blkid_tag_iterate_end(iter);
     }
+    blkid_put_cache(cache);
 
     return OK;
 }
 
+status_t ReadPartMetadata(const std::string& path, std::string& fsType,
+        std::string& fsUuid, std::string& fsLabel) {
+    status_t res = ProbeFilesystem(path, fsType, fsUuid, fsLabel);
+    if (res != -ENOENT) {
+        // Found, or the device couldn't be read and blkid would fail too
+        return res;
+    }
+    return readBlkidMetadata(path, fsType, fsUuid, fsLabel);
+}
+
+status_t ReadPartMetadata(const std::string& path, dev_t disk, uint64_t generation,
+        std::string& fsType, std::string& fsUuid, std::string& fsLabel) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == -1 || !S_ISBLK(sb.st_mode)) {
+        return ReadPartMetadata(path, fsType, fsUuid, fsLabel);
+    }
+
+    ProbeCache* cache = ProbeCache::Instance();
+    std::string type, uuid, label;
+    if (!cache->lookup(sb.st_rdev, generation, type, uuid, label)) {
+        uint64_t epoch = cache->getEpoch();
+        status_t res = ReadPartMetadata(path, type, uuid, label);
+        if (res != OK) {
+            // Not cached, so a disk still spinning up is probed again
+            return res;
+        }
+        cache->insert(sb.st_rdev, disk, generation, epoch, type, uuid, label);
+    }
+
+    // Like a plain probe, leave the outputs alone if nothing was found
+    if (!type.empty()) {
+        fsType = type;
+        fsUuid = uuid;
+        fsLabel = label;
+    }
+    return OK;
+}
+
+void ForgetPartMetadata(const std::string& path) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == 0 && S_ISBLK(sb.st_mode)) {
+        ProbeCache::Instance()->invalidate(sb.st_rdev);
+    }
+}
+
 
 status_t ForkExecvp(const std::vector<std::string>& args) {
     return ForkExecvp(args, nullptr);
@@ -501,6 +595,10 @@ std::string DefaultFstabPath() {
 }
 
 status_t RestoreconRecursive(const std::string& path) {
+    // The property handshake below only tracks one path at a time
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+
     LOG(VERBOSE) << "Starting restorecon of " << path;
 
     // TODO: find a cleaner way of waiting for restorecon to finish
@@ -557,40 +655,18 @@ status_t readBlockDevMajorAndMinor(
     major.clear();
     minor.clear();
 
-    std::vector<std::string> cmd;
-    cmd.push_back("/system/bin/ls");
-    cmd.push_back("-l");
-    cmd.push_back(devPath);
-
-    std::vector<std::string> output;
-    status_t res = ForkExecvp(cmd, output);
-    if (res != OK) {
-        LOG(WARNING) << "failed to identify ls -l " << devPath;
-        return res;
+    struct stat sb;
+    if (stat(devPath.c_str(), &sb) == -1) {
+        PLOG(WARNING) << "Failed to stat " << devPath;
+        return -errno;
     }
-
-    // Extract values from output
-    // brw------- root     root     179,   1 2015-01-01 00:00 mmcblk0p1
-    char value[128];
-    for (auto line : output) {
-        int count = sscanf(line.c_str(), "%3s", value);
-        if (count == 1 && !strcmp(value, "brw")) {              // block device
-            char f[128], s[128];
-            if (sscanf(line.c_str(), "%[^','],%s", f, s) == 2) { // split ','
-                minor = s;
-                char *cline = strdup(f);
-                char *str = strtok(cline, " ");
-                char buf[25];
-                while (str != nullptr) {
-                    if (sscanf(str, "%[1-9]", buf) == 1) {
-                        major = buf;
-                    }
-                    str = strtok(nullptr, " ");
-                }
-            }
-        }
+    if (!S_ISBLK(sb.st_mode)) {
+        LOG(WARNING) << devPath << " is not a block device";
+        return -ENOTBLK;
     }
 
+    major = StringPrintf("%u", major(sb.st_rdev));
+    minor = StringPrintf("%u", minor(sb.st_rdev));
     return OK;
 }
 
@@ -617,97 +693,27 @@ status_t GetPhysicalDevice(
 status_t GetLogicalPartitionDevice(
     const dev_t device, const std::string& sysPath, std::string& logicalPartitionDev) {
     std::string physicalDev;
-    const unsigned int kMajorBlockMmc = 179;
-    const unsigned int kMaxNumOfPartition = 31;
-
-    // logical partition dev's major & minor
-    unsigned int devMajor = major(device);
-    unsigned int devMinor = minor(device);
 
     if (GetPhysicalDevice(sysPath, physicalDev) != OK) {
         return -1;
     }
 
     LOG(INFO) << "physical dev: " << physicalDev <<
-        ", logical partition dev's major: " << devMajor << ", minor: " << devMinor;
-
-    // For now, assume that MMC devices are SD, and that
-    // everything else is USB
-    std::string lpDev;
-    std::string major, minor;
-    for (unsigned int i = 1; i <= kMaxNumOfPartition; i ++) {
-        if (devMajor == kMajorBlockMmc) {   // SD
-            lpDev =  StringPrintf("%sp%d", physicalDev.c_str(), i);
-        } else {    // USB
-            lpDev =  StringPrintf("%s%d", physicalDev.c_str(), i);
-        }
-
-        if (!access(lpDev.c_str(), F_OK) &&
-            readBlockDevMajorAndMinor(lpDev, major, minor) == OK &&
-            (int)devMajor == atoi(major.c_str()) &&
-            (int)devMinor == atoi(minor.c_str())) {
+        ", logical partition dev's major: " << major(device) << ", minor: " << minor(device);
+
+    BlockTopology* topology = BlockTopology::Instance();
+    BlockTopology::Node part, disk;
+    if (topology->findDevice(device, part) && topology->findDevice(part.parent, disk)
+            && physicalDev == StringPrintf("/dev/block/%s", disk.name.c_str())) {
+        std::string lpDev = StringPrintf("/dev/block/%s", part.name.c_str());
+        if (!access(lpDev.c_str(), F_OK)) {
             logicalPartitionDev = lpDev;
             LOG(INFO) << "find logical partition dev: " << logicalPartitionDev;
-            break;
         }
     }
 
     return OK;
 }
 
-// Such as /dev/block/sda is used, return true,otherwise false
-// just true,saved sda to physicalDevName
-bool IsJustPhysicalDevice(
-    const std::string& sysPath, std::string& physicalDevName) {
-    std::string major, minor;
-    std::string physicalDev;
-    std::string logicalPartitionDev;
-    const unsigned int kMajorBlockMmc = 179;
-
-    if (GetPhysicalDevice(sysPath, physicalDev) == OK) {
-        std::vector<std::string> cmd;
-        cmd.push_back(kBlkidPath);
-        cmd.push_back("-c");
-        cmd.push_back("/dev/null");
-        cmd.push_back("-s");
-        cmd.push_back("TYPE");
-        cmd.push_back("-s");
-        cmd.push_back("UUID");
-        cmd.push_back("-s");
-        cmd.push_back("LABEL");
-        cmd.push_back(physicalDev);
-
-        std::vector<std::string> output;
-        status_t res = ForkExecvp(cmd, output,  sBlkidUntrustedContext);
-        if (res != OK) {
-            LOG(WARNING) << "failed to identify blkid " << physicalDev;
-            return false;
-        }
-
-        char value[128];
-        for (auto line : output) {
-            // Extract values from blkid output, if defined
-            const char* cline = line.c_str();
-            if (!strncmp(cline, physicalDev.c_str(), strlen(physicalDev.c_str()))) {
-                if (readBlockDevMajorAndMinor(physicalDev, major, minor) == OK) {
-                    logicalPartitionDev = (atoi(major.c_str()) == kMajorBlockMmc) ?
-                        StringPrintf("%sp1", physicalDev.c_str()) :
-                        StringPrintf("%s1", physicalDev.c_str());
-                    if (access(logicalPartitionDev.c_str(), F_OK)) {
-                        // And logical partition device doesn't exist,
-                        // we're sure physical device is used.
-                        // length /dev/block/ = 11,such as sda or mmcblk0,
-                        // we get as physical device name.
-                        physicalDevName = StringPrintf("%s", physicalDev.substr(11).c_str());
-                        return true;
-                    }
-                }
-            }
-        }
-    }
-
-    return false;
-}
-
 }  // namespace vold
 }  // namespace android
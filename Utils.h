@@ -18,6 +18,7 @@
 #define ANDROID_VOLD_UTILS_H
 
 #include <utils/Errors.h>
+#include <utils/Timers.h>
 #include <cutils/multiuser.h>
 #include <selinux/selinux.h>
 
@@ -52,12 +53,32 @@ status_t ForceUnmount(const std::string& path);
 /* Kills any processes using given path */
 status_t KillProcessesUsingPath(const std::string& path);
 
+/*
+ * Bounds ForceUnmount() and KillProcessesUsingPath() on the calling
+ * thread: once the next escalation step would run past this monotonic
+ * time, they give up waiting and ForceUnmount() syncs and lazily detaches
+ * instead. Zero clears the deadline.
+ */
+void SetUnmountDeadline(nsecs_t deadline);
+
 /* Creates bind mount from source to target */
 status_t BindMount(const std::string& source, const std::string& target);
 
-/* Reads filesystem metadata from untrusted device at path */
+/*
+ * Reads filesystem metadata from untrusted device at path. Returns OK
+ * with the outputs untouched if no filesystem was found, or a negative
+ * errno if the device couldn't be read.
+ */
 status_t ReadPartMetadata(const std::string& path, std::string& fsType,
         std::string& fsUuid, std::string& fsLabel);
+/*
+ * Same, but answered from the probe cache while the media generation of
+ * the disk holding path is unchanged. Failed reads are not cached.
+ */
+status_t ReadPartMetadata(const std::string& path, dev_t disk, uint64_t generation,
+        std::string& fsType, std::string& fsUuid, std::string& fsLabel);
+/* Drops the cached probe result of path, e.g. before formatting it */
+void ForgetPartMetadata(const std::string& path);
 
 /* Returns either WEXITSTATUS() status, or a negative errno */
 status_t ForkExecvp(const std::vector<std::string>& args);
@@ -145,11 +166,6 @@ status_t GetLogicalPartitionDevice(
     const std::string& sysPath,
     std::string& logicalPartitionDev);
 
-/* Check sd/udisk physical devices whether are used */
-bool IsJustPhysicalDevice(
-    const std::string& sysPath,
-    std::string& physicalDevName);
-
 status_t readBlockDevMajorAndMinor(
     const std::string& devPath,
     std::string& major, std::string& minor);
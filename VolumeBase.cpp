@@ -35,7 +35,8 @@ namespace droidvold {
 
 VolumeBase::VolumeBase(Type type) :
         mType(type), mMountFlags(0), mMountUserId(-1), mCreated(false), mState(
-                State::kUnmounted), mSilent(false), mDiskFlags(0), mPartNo(0) {
+                State::kUnmounted), mSilent(false), mDiskFlags(0), mPartNo(0),
+        mDiskDevice(0), mMediaGeneration(0) {
 }
 
 VolumeBase::~VolumeBase() {
@@ -44,7 +45,7 @@ VolumeBase::~VolumeBase() {
 
 void VolumeBase::setState(State state) {
     mState = state;
-    notifyEvent(ResponseCode::VolumeStateChanged, StringPrintf("%d", mState));
+    notifyEvent(ResponseCode::VolumeStateChanged, static_cast<int64_t>(mState));
 }
 
 status_t VolumeBase::setDiskId(const std::string& diskId) {
@@ -97,6 +98,16 @@ status_t VolumeBase::setPartNo(int part) {
     return OK;
 }
 
+status_t VolumeBase::setDiskDevice(dev_t device) {
+    if (mCreated) {
+        LOG(WARNING) << getId() << " disk device change requires destroyed";
+        return -EBUSY;
+    }
+
+    mDiskDevice = device;
+    return OK;
+}
+
 status_t VolumeBase::setMountUserId(userid_t mountUserId) {
     if ((mState != State::kUnmounted) && (mState != State::kUnmountable)) {
         LOG(WARNING) << getId() << " user change requires state unmounted or unmountable";
@@ -150,15 +161,21 @@ status_t VolumeBase::setInternalPath(const std::string& internalPath) {
 }
 
 void VolumeBase::notifyEvent(int event) {
-    if (mSilent) return;
-    VolumeManager::Instance()->getBroadcaster()->sendBroadcast(event,
-            getId());
+    notifyEvent(StorageEvent(event, ""));
 }
 
 void VolumeBase::notifyEvent(int event, const std::string& value) {
+    notifyEvent(StorageEvent(event, "").add(value));
+}
+
+void VolumeBase::notifyEvent(int event, int64_t value) {
+    notifyEvent(StorageEvent(event, "").add(value));
+}
+
+void VolumeBase::notifyEvent(StorageEvent event) {
     if (mSilent) return;
-    VolumeManager::Instance()->getBroadcaster()->sendBroadcast(event,
-            StringPrintf("%s %s", getId().c_str(), value.c_str()));
+    event.setId(getId());
+    VolumeManager::Instance()->getBroadcaster()->sendBroadcast(event);
 }
 
 
@@ -184,8 +201,8 @@ status_t VolumeBase::create() {
 
     mCreated = true;
     status_t res = doCreate();
-    notifyEvent(ResponseCode::VolumeCreated,
-            StringPrintf("%d \"%s\" \"%s\"", mType, mDiskId.c_str(), mPartGuid.c_str()));
+    notifyEvent(StorageEvent(ResponseCode::VolumeCreated, "")
+            .add(static_cast<int64_t>(mType)).addQuoted(mDiskId).addQuoted(mPartGuid));
     setState(State::kUnmounted);
     return res;
 }
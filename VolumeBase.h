@@ -17,12 +17,14 @@
 #ifndef ANDROID_VOLD_VOLUME_BASE_H
 #define ANDROID_VOLD_VOLUME_BASE_H
 
+#include "StorageEvent.h"
 #include "Utils.h"
 
 #include <cutils/multiuser.h>
 #include <utils/Errors.h>
 
 #include <sys/types.h>
+#include <atomic>
 #include <list>
 #include <string>
 
@@ -86,6 +88,8 @@ public:
     const std::string& getInternalPath() { return mInternalPath; }
     int getDiskFlags() { return mDiskFlags; }
     int getPartNo() { return mPartNo; }
+    dev_t getDiskDevice() { return mDiskDevice; }
+    uint64_t getMediaGeneration() { return mMediaGeneration; }
 
     status_t setDiskId(const std::string& diskId);
     status_t setPartGuid(const std::string& partGuid);
@@ -95,6 +99,9 @@ public:
     void setSysPath(const std::string& sysPath) { mSysPath = sysPath; }
     status_t setDiskFlags(int diskFlags);
     status_t setPartNo(int part);
+    status_t setDiskDevice(dev_t device);
+    /* Set by the disk whenever its media changes; keys cached probes */
+    void setMediaGeneration(uint64_t generation) { mMediaGeneration = generation; }
 
     void addVolume(const std::shared_ptr<VolumeBase>& volume);
     void removeVolume(const std::shared_ptr<VolumeBase>& volume);
@@ -122,6 +129,9 @@ protected:
     status_t setInternalPath(const std::string& internalPath);
     void notifyEvent(int msg);
     void notifyEvent(int msg, const std::string& value);
+    void notifyEvent(int msg, int64_t value);
+    /* For events with several arguments; the ID is filled in here */
+    void notifyEvent(StorageEvent event);
 
 private:
     /* ID that uniquely references volume while alive */
@@ -150,6 +160,9 @@ private:
     bool mSilent;
     int mDiskFlags;
     int mPartNo;
+    /* Kernel device of the parent disk */
+    dev_t mDiskDevice;
+    std::atomic<uint64_t> mMediaGeneration;
 
     /* Volumes stacked on top of this volume */
     std::list<std::shared_ptr<VolumeBase>> mVolumes;
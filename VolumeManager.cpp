@@ -32,12 +32,18 @@
 #include <linux/kdev_t.h>
 #include <linux/loop.h>
 
+#include <algorithm>
+#include <set>
+#include <thread>
+
 #define LOG_TAG "droidVold"
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 #include <cutils/fs.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <selinux/android.h>
 
@@ -46,12 +52,15 @@
 
 #include "VolumeManager.h"
 #include "NetlinkManager.h"
+#include "BlockTopology.h"
 #include "DroidVold.h"
+#include "FsProbe.h"
 
 #include "fs/Ext4.h"
 #include "fs/Vfat.h"
 #include "Utils.h"
 #include "Process.h"
+#include "UeventRecorder.h"
 #include "fs/Iso9660.h"
 
 #ifdef HAS_VIRTUAL_CDROM
@@ -59,12 +68,22 @@
 #define LOOP_MOUNTPOINT "/mnt/loop"
 #endif
 
+using android::base::ReadFileToString;
 using android::base::StringPrintf;
+using android::droidvold::BlockEvent;
+using android::droidvold::UeventRecord;
 
 static const unsigned int kMajorBlockMmc = 179;
 static const unsigned int kMajorBlockExperimentalMin = 240;
 static const unsigned int kMajorBlockExperimentalMax = 254;
 
+static const char* kSysBlockPath = "/sys/block";
+/* Volumes of one disk mounted at once by mountAll() */
+static const int kDefaultMountParallelism = 4;
+/* Budget shared by all volumes in shutdown() and unmountAll() */
+static const int kDefaultUnmountTimeoutMs = 8000;
+static const char* kSysClassBlockPath = "/sys/class/block";
+
 VolumeManager *VolumeManager::sInstance = NULL;
 
 VolumeManager *VolumeManager::Instance() {
@@ -75,6 +94,9 @@ VolumeManager *VolumeManager::Instance() {
 
 VolumeManager::VolumeManager() {
     mDebug = false;
+    mBootDisks = 0;
+    mStorageReadyTime = -1;
+    mVolumeSnapshot = std::make_shared<const VolumeSnapshot>();
     mBroadcaster = NULL;
 #ifdef HAS_VIRTUAL_CDROM
     mLoopPath = NULL;
@@ -101,124 +123,452 @@ int VolumeManager::stop() {
     return 0;
 }
 
-void VolumeManager::handleBlockEvent(NetlinkEvent *evt) {
+void VolumeManager::handleBlockEvent(const std::shared_ptr<NetlinkEvent>& evt) {
+    std::lock_guard<std::mutex> lock(mLock);
+    handleBlockEventLocked(evt);
+}
+
+void VolumeManager::handleBlockEvents(const std::vector<std::shared_ptr<NetlinkEvent>>& events) {
     std::lock_guard<std::mutex> lock(mLock);
 
+    if (mDebug) {
+        LOG(VERBOSE) << "handleBlockEvents with " << events.size() << " events";
+    }
+
+    for (auto& evt : events) {
+        handleBlockEventLocked(evt);
+    }
+}
+
+void VolumeManager::handleBlockEventLocked(const std::shared_ptr<NetlinkEvent>& evt) {
     if (mDebug) {
         LOG(VERBOSE) << "----------------";
         LOG(VERBOSE) << "handleBlockEvent with action " << (int) evt->getAction();
         evt->dump();
     }
 
-    std::string devType(evt->findParam("DEVTYPE")?evt->findParam("DEVTYPE"):"");
-
-
-    if (devType == "disk") {
-        std::string eventPath(evt->findParam("DEVPATH")?evt->findParam("DEVPATH"):"");
-        std::string devName(evt->findParam("DEVNAME")?evt->findParam("DEVNAME"):"");
+    BlockEvent rec(evt);
+    android::droidvold::BlockTopology::Instance()->handleBlockEvent(rec);
 
-        int major = atoi(evt->findParam("MAJOR"));
-        int minor = atoi(evt->findParam("MINOR"));
-        dev_t device = makedev(major, minor);
+    if (rec.type == BlockEvent::Type::kDisk) {
+        int major = rec.devMajor;
+        int minor = rec.devMinor;
+        dev_t device = rec.getDevice();
 
-        switch (evt->getAction()) {
+        switch (rec.action) {
         case NetlinkEvent::Action::kAdd: {
-            for (auto source : mDiskSources) {
-                if (source->matches(eventPath)) {
-                    // For now, assume that MMC and virtio-blk (the latter is
-                    // emulator-specific; see Disk.cpp for details) devices are SD,
-                    // and that everything else is USB
-                    int flags = source->getFlags();
-                    if (major == kMajorBlockMmc
-                        || (android::droidvold::IsRunningInEmulator()
-                        && major >= (int) kMajorBlockExperimentalMin
-                        && major <= (int) kMajorBlockExperimentalMax)) {
-                        flags |= android::droidvold::Disk::Flags::kSd;
-                    } else {
-                        flags |= android::droidvold::Disk::Flags::kUsb;
-                    }
-
-                    auto disk = new android::droidvold::Disk(eventPath, device,
-                            source->getNickname(), devName, flags);
-                    disk->create();
-                    mDisks.push_back(std::shared_ptr<android::droidvold::Disk>(disk));
-                    break;
-                }
-            }
+            addDiskLocked(rec.devPath.str(), device, rec.devName.str());
             break;
         }
         case NetlinkEvent::Action::kChange: {
             LOG(DEBUG) << "Disk at " << major << ":" << minor << " changed";
-            for (auto disk : mDisks) {
-                if (disk->getDevice() == device) {
-                    if (disk->isSrdiskMounted()) {
-                        LOG(DEBUG) << "srdisk  ejected";
-                        disk->destroyAllVolumes();
-                        break;
-                    }
-
-                    //disk->readMetadata();
-                    //disk->readPartitions();
-                }
+            // Drop stale probe results now, not once the worker gets to it
+            android::droidvold::ProbeCache::Instance()->invalidateDisk(device);
+            auto it = mDiskIndex.find(device);
+            if (it != mDiskIndex.end()) {
+                it->second->postMediaChange();
             }
             break;
         }
         case NetlinkEvent::Action::kRemove: {
-            auto i = mDisks.begin();
-            while (i != mDisks.end()) {
-                if ((*i)->getDevice() == device) {
-                    (*i)->destroy();
-                    i = mDisks.erase(i);
-                } else {
-                    ++i;
-                }
+            android::droidvold::ProbeCache::Instance()->invalidateDisk(device);
+            auto it = mDiskIndex.find(device);
+            if (it != mDiskIndex.end()) {
+                auto disk = it->second;
+                mDiskIndex.erase(it);
+                disk->postDestroy();
+                mDrainingDisks[device] = disk;
+                mDisks.remove(disk);
             }
             break;
         }
         default: {
-            LOG(WARNING) << "Unexpected block event action " << (int) evt->getAction();
+            LOG(WARNING) << "Unexpected block event action " << (int) rec.action;
             break;
         }
         }
 
     } else {
-        for (auto disk : mDisks) {
-            disk->handleBlockEvent(evt);
+        // Shared by every disk the event is routed to
+        std::shared_ptr<const BlockEvent> shared;
+        for (auto& disk : mDisks) {
+            // Partitions live below their disk, e.g. .../block/sda/sda1
+            if (rec.devPath.isBelow(disk->getEventPath())) {
+                if (shared == nullptr) {
+                    shared = std::make_shared<const BlockEvent>(rec);
+                }
+                disk->postBlockEvent(shared);
+            }
+        }
+    }
+
+}
+
+std::shared_ptr<android::droidvold::Disk> VolumeManager::addDiskLocked(
+        const std::string& eventPath, dev_t device, const std::string& devName) {
+    int major = major(device);
+    int minor = minor(device);
+
+    if (mDiskIndex.find(device) != mDiskIndex.end()) {
+        LOG(DEBUG) << "Disk at " << major << ":" << minor << " already added";
+        return nullptr;
+    }
+
+    auto source = findDiskSource(eventPath);
+    if (source == nullptr) {
+        return nullptr;
+    }
+
+    // For now, assume that MMC and virtio-blk (the latter is
+    // emulator-specific; see Disk.cpp for details) devices are SD,
+    // and that everything else is USB
+    int flags = source->getFlags();
+    if (major == (int) kMajorBlockMmc
+        || (android::droidvold::IsRunningInEmulator()
+        && major >= (int) kMajorBlockExperimentalMin
+        && major <= (int) kMajorBlockExperimentalMax)) {
+        flags |= android::droidvold::Disk::Flags::kSd;
+    } else {
+        flags |= android::droidvold::Disk::Flags::kUsb;
+    }
+
+    auto disk = std::make_shared<android::droidvold::Disk>(eventPath,
+            device, source->getNickname(), devName, flags);
+    std::shared_ptr<android::droidvold::Disk> predecessor;
+    auto draining = mDrainingDisks.find(device);
+    if (draining != mDrainingDisks.end()) {
+        predecessor = draining->second.lock();
+        mDrainingDisks.erase(draining);
+    }
+    mDisks.push_back(disk);
+    mDiskIndex[device] = disk;
+    disk->postCreate(predecessor);
+    return disk;
+}
+
+void VolumeManager::waitForIdle() {
+    std::list<std::shared_ptr<android::droidvold::Disk>> disks;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        disks = mDisks;
+        for (auto& entry : mDrainingDisks) {
+            auto disk = entry.second.lock();
+            if (disk != nullptr) {
+                disks.push_back(disk);
+            }
+        }
+    }
+
+    for (auto disk : disks) {
+        disk->waitForIdle();
+    }
+}
+
+// Fills in rec from a sysfs block directory such as /sys/block/sda/sda1
+static bool readSysfsBlockDevice(const std::string& sysPath, const std::string& name,
+        UeventRecord& rec) {
+    std::string dev;
+    if (!ReadFileToString(sysPath + "/dev", &dev)
+            || sscanf(dev.c_str(), "%d:%d", &rec.devMajor, &rec.devMinor) != 2) {
+        return false;
+    }
+
+    char realPath[PATH_MAX];
+    if (realpath(sysPath.c_str(), realPath) == nullptr || strncmp(realPath, "/sys/", 5)) {
+        return false;
+    }
+    rec.devPath = realPath + 4;
+    rec.devName = name;
+
+    std::string partition;
+    if (ReadFileToString(sysPath + "/partition", &partition)) {
+        rec.devType = "partition";
+        rec.partN = atoi(partition.c_str());
+    } else {
+        rec.devType = "disk";
+    }
+    return true;
+}
+
+static void readSysfsPartitions(const std::string& sysPath, std::vector<UeventRecord>& parts) {
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(sysPath.c_str()), closedir);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent* de;
+    while ((de = readdir(dir.get())) != nullptr) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        UeventRecord rec;
+        std::string partPath = StringPrintf("%s/%s", sysPath.c_str(), de->d_name);
+        if (readSysfsBlockDevice(partPath, de->d_name, rec) && rec.devType == "partition") {
+            parts.push_back(rec);
+        }
+    }
+}
+
+int VolumeManager::scanBlockDevices() {
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(kSysClassBlockPath), closedir);
+    if (!dir) {
+        PLOG(ERROR) << "Failed to open " << kSysClassBlockPath;
+        return -errno;
+    }
+
+    // /sys/class/block lists disks and partitions side by side; only
+    // resolve the links here, nothing on the media is touched yet.
+    std::vector<UeventRecord> disks;
+    std::vector<UeventRecord> parts;
+    struct dirent* de;
+    while ((de = readdir(dir.get())) != nullptr) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+
+        UeventRecord rec;
+        std::string sysPath = StringPrintf("%s/%s", kSysClassBlockPath, de->d_name);
+        if (!readSysfsBlockDevice(sysPath, de->d_name, rec)) {
+            continue;
+        }
+        if (rec.devType == "partition") {
+            parts.push_back(rec);
+        } else {
+            disks.push_back(rec);
+        }
+    }
+
+    std::sort(parts.begin(), parts.end(), [](const UeventRecord& a, const UeventRecord& b) {
+        return a.partN < b.partN;
+    });
+
+    size_t found = 0;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        for (auto& rec : disks) {
+            if (findDiskSource(rec.devPath) == nullptr) {
+                continue;
+            }
+
+            auto disk = addDiskLocked(rec.devPath,
+                    makedev(rec.devMajor, rec.devMinor), rec.devName);
+            if (disk == nullptr) {
+                continue;
+            }
+            found++;
+
+            for (auto& part : parts) {
+                if (part.devPath.size() > rec.devPath.size()
+                        && part.devPath[rec.devPath.size()] == '/'
+                        && !part.devPath.compare(0, rec.devPath.size(), rec.devPath)) {
+                    disk->postAddPartition(part.partN);
+                }
+            }
+        }
+    }
+
+    LOG(INFO) << "Found " << found << " disks in " << kSysClassBlockPath << " in "
+            << (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1000 << "us";
+
+    mBootDisks = found;
+    std::thread([this, start] {
+        waitForIdle();
+        mStorageReadyTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        LOG(INFO) << "Storage ready " << mStorageReadyTime / 1000000 << "ms after scan";
+    }).detach();
+
+    return 0;
+}
+
+std::shared_ptr<VolumeManager::DiskSource> VolumeManager::findDiskSource(
+        const std::string& eventPath) {
+    int index = mDiskSourceMatcher.match(eventPath);
+    return index < 0 ? nullptr : mDiskSources[index];
+}
+
+void VolumeManager::buildResyncEvents(std::vector<std::shared_ptr<NetlinkEvent>>& events) {
+    // Lost uevents may have touched any device, not just our disks
+    android::droidvold::BlockTopology::Instance()->invalidate();
+    auto disks = getDisks();
+    std::vector<UeventRecord> records;
+    std::set<dev_t> present;
+
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(kSysBlockPath), closedir);
+    if (!dir) {
+        PLOG(ERROR) << "Failed to open " << kSysBlockPath;
+        return;
+    }
+
+    struct dirent* de;
+    while ((de = readdir(dir.get())) != nullptr) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+
+        UeventRecord rec;
+        std::string sysPath = StringPrintf("%s/%s", kSysBlockPath, de->d_name);
+        if (!readSysfsBlockDevice(sysPath, de->d_name, rec)) {
+            continue;
+        }
+        dev_t device = makedev(rec.devMajor, rec.devMinor);
+        present.insert(device);
+
+        std::vector<UeventRecord> parts;
+        readSysfsPartitions(sysPath, parts);
+
+        auto disk = std::find_if(disks.begin(), disks.end(),
+                [device](const std::shared_ptr<android::droidvold::Disk>& d) {
+                    return d->getDevice() == device;
+                });
+        if (disk == disks.end()) {
+            if (findDiskSource(rec.devPath) == nullptr) {
+                continue;
+            }
+            LOG(INFO) << "Resync found missing disk " << rec.devPath;
+            rec.action = NetlinkEvent::Action::kAdd;
+            records.push_back(rec);
+            for (auto& part : parts) {
+                part.action = NetlinkEvent::Action::kAdd;
+                records.push_back(part);
+            }
+        } else {
+            std::vector<int> known;
+            (*disk)->listPartitions(known);
+            for (auto& part : parts) {
+                if (std::find(known.begin(), known.end(), part.partN) == known.end()) {
+                    LOG(INFO) << "Resync found missing partition " << part.devPath;
+                    part.action = NetlinkEvent::Action::kAdd;
+                    records.push_back(part);
+                }
+            }
+        }
+    }
+
+    for (auto disk : disks) {
+        if (present.find(disk->getDevice()) == present.end()) {
+            LOG(INFO) << "Resync found stale disk " << disk->getEventPath();
+            UeventRecord rec;
+            rec.action = NetlinkEvent::Action::kRemove;
+            rec.devPath = disk->getEventPath();
+            rec.devType = "disk";
+            rec.devMajor = major(disk->getDevice());
+            rec.devMinor = minor(disk->getDevice());
+            records.push_back(rec);
         }
     }
 
+    for (auto& rec : records) {
+        std::shared_ptr<NetlinkEvent> evt = rec.toNetlinkEvent();
+        if (evt != nullptr) {
+            events.push_back(evt);
+        }
+    }
+}
+
+std::list<std::shared_ptr<android::droidvold::Disk>> VolumeManager::getDisks() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDisks;
 }
 
 void VolumeManager::addDiskSource(const std::shared_ptr<DiskSource>& diskSource) {
     mDiskSources.push_back(diskSource);
+    mDiskSourceMatcher.add(diskSource->getSysPattern());
 }
 
-std::shared_ptr<android::droidvold::VolumeBase> VolumeManager::findVolume(const std::string& id) {
+void VolumeManager::compileDiskSources() {
+    mDiskSourceMatcher.compile();
+    LOG(INFO) << "Compiled " << mDiskSources.size() << " disk sources into "
+            << mDiskSourceMatcher.getDfaSize() << " DFA states";
+}
 
-    for (auto disk : mDisks) {
-        auto vol = disk->findVolume(id);
-        if (vol != nullptr) {
-            return vol;
-        }
+void VolumeManager::indexVolume(const std::shared_ptr<android::droidvold::VolumeBase>& vol) {
+    std::lock_guard<std::mutex> lock(mVolumeSnapshotLock);
+    auto snapshot = std::make_shared<VolumeSnapshot>(*mVolumeSnapshot);
+    snapshot->volumes.push_back(vol);
+    snapshot->byId[vol->getId()] = vol;
+    std::atomic_store(&mVolumeSnapshot, std::shared_ptr<const VolumeSnapshot>(snapshot));
+}
+
+void VolumeManager::unindexVolume(const std::shared_ptr<android::droidvold::VolumeBase>& vol) {
+    std::lock_guard<std::mutex> lock(mVolumeSnapshotLock);
+    auto snapshot = std::make_shared<VolumeSnapshot>(*mVolumeSnapshot);
+    auto& volumes = snapshot->volumes;
+    volumes.erase(std::remove(volumes.begin(), volumes.end(), vol), volumes.end());
+    auto it = snapshot->byId.find(vol->getId());
+    // A successor disk may already have reused the ID
+    if (it != snapshot->byId.end() && it->second == vol) {
+        snapshot->byId.erase(it);
     }
-    return nullptr;
+    std::atomic_store(&mVolumeSnapshot, std::shared_ptr<const VolumeSnapshot>(snapshot));
+}
+
+std::shared_ptr<android::droidvold::VolumeBase> VolumeManager::findVolume(const std::string& id) {
+    auto snapshot = getVolumeSnapshot();
+    auto it = snapshot->byId.find(id);
+    return it == snapshot->byId.end() ? nullptr : it->second;
 }
 
 void VolumeManager::listVolumes(android::droidvold::VolumeBase::Type type,
         std::list<std::string>& list) {
     list.clear();
-    for (auto disk : mDisks) {
-        disk->listVolumes(type, list);
+    for (auto& vol : getVolumeSnapshot()->volumes) {
+        if (vol->getType() == type) {
+            list.push_back(vol->getId());
+        }
     }
 }
 
-int VolumeManager::unmountAll() {
-    std::lock_guard<std::mutex> lock(mLock);
+int VolumeManager::mountAll(const std::string& diskId, int mountFlags, userid_t userId,
+        const android::droidvold::Disk::MountProgress& progress) {
+    for (auto disk : getDisks()) {
+        if (disk->getId() == diskId) {
+            size_t parallelism = std::max(property_get_int32("droidvold.mount_parallelism",
+                    kDefaultMountParallelism), 1);
+            return disk->postMountAll(mountFlags, userId, parallelism, progress);
+        }
+    }
+    return -ENOENT;
+}
+
+// Shared budget for unmounting, and at shutdown tearing down, all disks
+static nsecs_t getUnmountDeadline() {
+    return systemTime(SYSTEM_TIME_MONOTONIC) + milliseconds_to_nanoseconds(
+            property_get_int32("droidvold.unmount_timeout_ms", kDefaultUnmountTimeoutMs));
+}
 
-    for (auto disk : mDisks) {
-        disk->unmountAll();
+// Waits for the disks' workers until deadline and names those still busy
+static void waitForDisks(const std::list<std::shared_ptr<android::droidvold::Disk>>& disks,
+        nsecs_t deadline, const char* reason) {
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    std::string busy;
+    for (auto& disk : disks) {
+        if (!disk->waitForIdle(deadline)) {
+            busy += " " + disk->getId();
+        }
+    }
+
+    LOG(INFO) << reason << " finished " << disks.size() << " disks in "
+            << nanoseconds_to_milliseconds(systemTime(SYSTEM_TIME_MONOTONIC) - start) << "ms";
+    if (!busy.empty()) {
+        LOG(WARNING) << reason << " deadline passed, abandoning busy disks:" << busy;
     }
+}
 
+void VolumeManager::unmountVolumes(
+        const std::list<std::shared_ptr<android::droidvold::Disk>>& disks,
+        nsecs_t deadline, const char* reason) {
+    // Each worker unmounts its own disk's volumes, so nothing races with a
+    // volume being destroyed there, while disks still proceed in parallel
+    for (auto& disk : disks) {
+        disk->postUnmountAll(deadline);
+    }
+    waitForDisks(disks, deadline, reason);
+}
+
+int VolumeManager::unmountAll() {
+    unmountVolumes(getDisks(), getUnmountDeadline(), "unmountAll");
     return 0;
 }
 
@@ -352,19 +702,35 @@ bool VolumeManager::isMountpointMounted(const char *mp)
 int VolumeManager::reset() {
     // Tear down all existing disks/volumes and start from a blank slate so
     // newly connected framework hears all events.
-    for (auto disk : mDisks) {
-        disk->destroy();
-        disk->reset();
+    auto disks = getDisks();
+
+    for (auto disk : disks) {
+        disk->postReset();
+    }
+    for (auto disk : disks) {
+        disk->waitForIdle();
     }
 
     return 0;
 }
 
 int VolumeManager::shutdown() {
-    for (auto disk : mDisks) {
-        disk->destroy();
+    std::list<std::shared_ptr<android::droidvold::Disk>> disks;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        disks.swap(mDisks);
+        mDiskIndex.clear();
+    }
+
+    // Unmounting first lets disks proceed in parallel; the teardown then
+    // runs under what is left of the same deadline, so a disk that missed
+    // it detaches its volumes at once instead of escalating all over
+    nsecs_t deadline = getUnmountDeadline();
+    unmountVolumes(disks, deadline, "shutdown unmount");
+    for (auto disk : disks) {
+        disk->postDestroy(deadline);
     }
-    mDisks.clear();
+    waitForDisks(disks, deadline, "shutdown teardown");
     return 0;
 }
 
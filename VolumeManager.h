@@ -18,14 +18,16 @@
 #define ANDROID_DROIDVOLD_VOLUME_MANAGER_H
 
 #include <pthread.h>
-#include <fnmatch.h>
 #include <stdlib.h>
 
+#include <atomic>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <cutils/multiuser.h>
 #include <utils/List.h>
@@ -33,6 +35,7 @@
 #include <sysutils/NetlinkEvent.h>
 
 #include "Disk.h"
+#include "GlobMatcher.h"
 #include "VolumeBase.h"
 #include "DroidVold.h"
 
@@ -60,7 +63,20 @@ public:
     int start();
     int stop();
 
-    void handleBlockEvent(NetlinkEvent *evt);
+    /*
+     * Routes block uevents to the per-disk workers; only disk bookkeeping
+     * happens on the calling thread.
+     */
+    void handleBlockEvent(const std::shared_ptr<NetlinkEvent>& evt);
+    /* Handles a batch of block uevents drained in one wakeup, in order */
+    void handleBlockEvents(const std::vector<std::shared_ptr<NetlinkEvent>>& events);
+    /* Blocks until every disk worker has drained its queue */
+    void waitForIdle();
+    /*
+     * Compares /sys/block with mDisks after uevents were lost and
+     * synthesizes only the missing disk add/remove and partition add events.
+     */
+    void buildResyncEvents(std::vector<std::shared_ptr<NetlinkEvent>>& events);
 
     class DiskSource {
     public:
@@ -68,10 +84,7 @@ public:
                 mSysPattern(sysPattern), mNickname(nickname), mFlags(flags) {
         }
 
-        bool matches(const std::string& sysPath) {
-            return !fnmatch(mSysPattern.c_str(), sysPath.c_str(), 0);
-        }
-
+        const std::string& getSysPattern() { return mSysPattern; }
         const std::string& getNickname() { return mNickname; }
         int getFlags() { return mFlags; }
 
@@ -82,6 +95,27 @@ public:
     };
 
     void addDiskSource(const std::shared_ptr<DiskSource>& diskSource);
+    /* Compiles all disk source patterns into one matcher, after config */
+    void compileDiskSources();
+
+    /*
+     * Immutable view of every volume. Disk workers publish a new copy on
+     * each change, so HIDL threads look volumes up without taking a lock
+     * and without waiting on a slow probe.
+     */
+    struct VolumeSnapshot {
+        /* In creation order */
+        std::vector<std::shared_ptr<android::droidvold::VolumeBase>> volumes;
+        std::unordered_map<std::string,
+                std::shared_ptr<android::droidvold::VolumeBase>> byId;
+    };
+
+    /* Keeps the snapshot in step with the volumes disks create and destroy */
+    void indexVolume(const std::shared_ptr<android::droidvold::VolumeBase>& vol);
+    void unindexVolume(const std::shared_ptr<android::droidvold::VolumeBase>& vol);
+    std::shared_ptr<const VolumeSnapshot> getVolumeSnapshot() {
+        return std::atomic_load(&mVolumeSnapshot);
+    }
     std::shared_ptr<android::droidvold::VolumeBase> findVolume(const std::string& id);
     void listVolumes(android::droidvold::VolumeBase::Type type, std::list<std::string>& list);
 
@@ -92,6 +126,12 @@ public:
 
     /* Unmount all volumes, usually for encryption */
     int unmountAll();
+    /*
+     * Mounts every volume on one disk concurrently, bounded by
+     * droidvold.mount_parallelism; returns the number of failures.
+     */
+    int mountAll(const std::string& diskId, int mountFlags, userid_t userId,
+            const android::droidvold::Disk::MountProgress& progress = nullptr);
 
     /* for iso file mount and umount */
 #ifdef HAS_VIRTUAL_CDROM
@@ -112,13 +152,47 @@ public:
     bool isMountpointMounted(const char *mp);
     int mkdirs(char* path);
     void coldboot(const char *path);
+    /*
+     * Creates disks and partitions straight from /sys/class/block at
+     * startup, instead of asking the kernel to replay every add uevent.
+     */
+    int scanBlockDevices();
+    /* Disks found by scanBlockDevices() */
+    size_t getBootDiskCount() { return mBootDisks; }
+    /* Time from the startup scan until all disks settled, -1 while pending */
+    nsecs_t getStorageReadyTime() { return mStorageReadyTime; }
 
 private:
     VolumeManager();
 
+    void handleBlockEventLocked(const std::shared_ptr<NetlinkEvent>& evt);
+    std::shared_ptr<android::droidvold::Disk> addDiskLocked(const std::string& eventPath,
+            dev_t device, const std::string& devName);
+    std::list<std::shared_ptr<android::droidvold::Disk>> getDisks();
+    /*
+     * Unmounts every mounted volume of disks on the disks' workers, all
+     * disks at once, and waits no longer than deadline.
+     */
+    void unmountVolumes(const std::list<std::shared_ptr<android::droidvold::Disk>>& disks,
+            nsecs_t deadline, const char* reason);
+    /* First disk source whose pattern matches, in fstab order */
+    std::shared_ptr<DiskSource> findDiskSource(const std::string& eventPath);
+
     std::mutex mLock;
-    std::list<std::shared_ptr<DiskSource>> mDiskSources;
+    std::vector<std::shared_ptr<DiskSource>> mDiskSources;
+    android::droidvold::GlobMatcher mDiskSourceMatcher;
     std::list<std::shared_ptr<android::droidvold::Disk>> mDisks;
+    /* mDisks by device, for the change and remove paths */
+    std::unordered_map<dev_t, std::shared_ptr<android::droidvold::Disk>> mDiskIndex;
+    /* Removed disks that may still be tearing down on their worker */
+    std::unordered_map<dev_t, std::weak_ptr<android::droidvold::Disk>> mDrainingDisks;
+
+    /* Serializes snapshot writers; readers only use atomic_load */
+    std::mutex mVolumeSnapshotLock;
+    std::shared_ptr<const VolumeSnapshot> mVolumeSnapshot;
+
+    std::atomic<size_t> mBootDisks;
+    std::atomic<nsecs_t> mStorageReadyTime;
 };
 
 #endif
@@ -18,6 +18,7 @@
 #include "VolumeManager.h"
 #include "NetlinkManager.h"
 #include "DroidVold.h"
+#include "UeventRecorder.h"
 
 #define LOG_TAG "droidVold"
 
@@ -43,22 +44,34 @@
 #include <dirent.h>
 #include <fs_mgr.h>
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include "cutils/klog.h"
 #include "cutils/log.h"
 #include "cutils/properties.h"
 
 static int process_config(VolumeManager *vm, bool* has_adoptable);
+static void parse_args(int argc, char** argv);
+static int replay_uevents(VolumeManager *vm);
 
 static void set_media_poll_time(void);
 
 struct fstab *fstab;
 
+/* Offline replay of a uevent record, see UeventRecorder.h */
+static std::string sReplayPath;
+static double sReplaySpeed = 1.0;
+static std::map<std::string, std::string> sReplayMap;
+static int sReplayLookupThreads = 0;
+
 using namespace android;
 using ::android::base::StringPrintf;
 using ::android::hardware::configureRpcThreadpool;
 using ::android::hardware::joinRpcThreadpool;
 using ::vendor::amlogic::hardware::droidvold::V1_0::implementation::DroidVold;
-using ::vendor::amlogic::hardware::droidvold::V1_0::IDroidVold;
+using ::vendor::amlogic::droidvold::V1_0::IDroidVoldExt;
 using ::vendor::amlogic::hardware::droidvold::V1_0::Result;
 
 int main(int argc, char** argv) {
@@ -67,6 +80,8 @@ int main(int argc, char** argv) {
 
     LOG(INFO) << "doildVold 1.0 firing up";
 
+    parse_args(argc, argv);
+
     android::ProcessState::initWithDriver("/dev/hwbinder");
     configureRpcThreadpool(4, true);
 
@@ -97,6 +112,10 @@ int main(int argc, char** argv) {
     vm->setBroadcaster(dv);
     nm->setBroadcaster(dv);
 
+    if (!sReplayPath.empty()) {
+        exit(replay_uevents(vm));
+    }
+
     if (vm->start()) {
         PLOG(ERROR) << "Unable to start VolumeManager";
         exit(1);
@@ -113,7 +132,8 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    sp<IDroidVold> idv = DroidVold::Instance();
+    // Also serves IDroidVold 1.0, which IDroidVoldExt extends
+    sp<IDroidVoldExt> idv = DroidVold::Instance();
     if (idv == nullptr)
         ALOGE("Cannot create IDroidVold service");
     else if (idv->registerAsService() != OK)
@@ -122,7 +142,10 @@ int main(int argc, char** argv) {
         ALOGI("IDroidVold service created.");
 
     set_media_poll_time();
-    vm->coldboot("/sys/block");
+    if (vm->scanBlockDevices()) {
+        LOG(WARNING) << "Falling back to uevent coldboot";
+        vm->coldboot("/sys/block");
+    }
 
     /*
      * This thread is just going to process Binder transactions.
@@ -133,6 +156,57 @@ int main(int argc, char** argv) {
     exit(0);
 }
 
+static void parse_args(int argc, char** argv) {
+    static struct option opts[] = {
+        {"replay", required_argument, 0, 'r' },
+        {"speed", required_argument, 0, 's' },
+        {"map", required_argument, 0, 'm' },
+        {"lookup-threads", required_argument, 0, 'l' },
+        {0, 0, 0, 0 },
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", opts, nullptr)) != -1) {
+        switch (c) {
+        case 'r': sReplayPath = optarg; break;
+        case 's': sReplaySpeed = atof(optarg); break;
+        case 'l': sReplayLookupThreads = atoi(optarg); break;
+        case 'm': {
+            // --map sda=loop0
+            std::string map(optarg);
+            size_t pos = map.find('=');
+            if (pos == std::string::npos) {
+                LOG(ERROR) << "Ignoring malformed map " << map;
+                break;
+            }
+            sReplayMap[map.substr(0, pos)] = map.substr(pos + 1);
+            break;
+        }
+        }
+    }
+}
+
+static int replay_uevents(VolumeManager *vm) {
+    bool has_adoptable;
+
+    if (process_config(vm, &has_adoptable)) {
+        PLOG(ERROR) << "Error reading configuration... continuing anyways";
+    }
+
+    std::vector<android::droidvold::UeventRecord> records;
+    if (android::droidvold::ReadUeventRecords(sReplayPath, records)) {
+        return 1;
+    }
+    android::droidvold::RemapUeventRecords(records, sReplayMap);
+
+    android::droidvold::ReplayStats stats;
+    android::droidvold::ReplayUevents(records, sReplaySpeed, sReplayLookupThreads, stats);
+    android::droidvold::DumpReplayStats(stats, stdout);
+
+    vm->shutdown();
+    return 0;
+}
+
 static void set_media_poll_time(void) {
     int fd;
 
@@ -179,5 +253,6 @@ static int process_config(VolumeManager *vm, bool* has_adoptable) {
                     new VolumeManager::DiskSource(sysPattern, nickname, flags)));
         }
     }
+    vm->compileDiskSources();
     return 0;
 }